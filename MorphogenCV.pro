@@ -17,22 +17,26 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 SOURCES += \
     configparser.cpp \
+    filters.cpp \
     generator.cpp \
     imageoperations.cpp \
     main.cpp \
     mainwidget.cpp \
     plots.cpp \
-    qcustomplot.cpp
+    qcustomplot.cpp \
+    statistics.cpp
 
 HEADERS += \
     configparser.h \
+    filters.h \
     generator.h \
     imageoperations.h \
     mainwidget.h \
     parameter.h \
     parameterwidget.h \
     plots.h \
-    qcustomplot.h
+    qcustomplot.h \
+    statistics.h
 
 # Change path according to your system
 unix:INCLUDEPATH += /usr/include/opencv4
@@ -0,0 +1,986 @@
+// Copyright 2020 José María Castelo Ares
+
+// This file is part of MorphogenCV.
+
+// MorphogenCV is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// MorphogenCV is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with MorphogenCV.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "filters.h"
+#include <algorithm>
+
+// Van Herk/Gil-Werman morphology
+
+struct MinOperator
+{
+    static uchar neutral(){ return 255; }
+    uchar operator()(uchar a, uchar b) const { return std::min(a, b); }
+};
+
+struct MaxOperator
+{
+    static uchar neutral(){ return 0; }
+    uchar operator()(uchar a, uchar b) const { return std::max(a, b); }
+};
+
+bool decomposeStructuringElement(const cv::Mat &element, std::vector<cv::Size> &rects)
+{
+    rects.clear();
+
+    if (element.empty() || element.type() != CV_8UC1 || element.rows % 2 == 0 || element.cols % 2 == 0)
+        return false;
+
+    int centerX = element.cols / 2;
+    int centerY = element.rows / 2;
+
+    // Half width of the centered run of each row, -1 if the row is empty
+
+    std::vector<int> halfWidths(element.rows, -1);
+
+    for (int i = 0; i < element.rows; i++)
+    {
+        const uchar *row = element.ptr<uchar>(i);
+
+        int j1 = 0;
+        while (j1 < element.cols && !row[j1]) j1++;
+
+        if (j1 == element.cols)
+            continue;
+
+        int j2 = element.cols - 1;
+        while (!row[j2]) j2--;
+
+        for (int j = j1; j <= j2; j++)
+            if (!row[j])
+                return false;
+
+        if (centerX - j1 != j2 - centerX)
+            return false;
+
+        halfWidths[i] = centerX - j1;
+    }
+
+    // Each distinct half width spans a band of rows, which must be centered
+
+    std::vector<int> distinctHalfWidths;
+    for (int w: halfWidths)
+        if (w >= 0)
+            distinctHalfWidths.push_back(w);
+
+    std::sort(distinctHalfWidths.begin(), distinctHalfWidths.end());
+    distinctHalfWidths.erase(std::unique(distinctHalfWidths.begin(), distinctHalfWidths.end()), distinctHalfWidths.end());
+
+    int previousHalfHeight = -1;
+
+    for (auto it = distinctHalfWidths.rbegin(); it != distinctHalfWidths.rend(); ++it)
+    {
+        int i1 = 0;
+        while (halfWidths[i1] < *it) i1++;
+
+        int i2 = element.rows - 1;
+        while (halfWidths[i2] < *it) i2--;
+
+        for (int i = i1; i <= i2; i++)
+            if (halfWidths[i] < *it)
+                return false;
+
+        if (centerY - i1 != i2 - centerY)
+            return false;
+
+        // Narrower rectangles only count if they are taller
+
+        if (centerY - i1 > previousHalfHeight)
+        {
+            rects.push_back(cv::Size(*it, centerY - i1));
+            previousHalfHeight = centerY - i1;
+        }
+    }
+
+    return !rects.empty();
+}
+
+// Running min/max along rows: within blocks of size 2 * radius + 1, a prefix and a suffix
+// extremum are computed, and each output is the extremum of one suffix and one prefix
+
+template <class Operator>
+static void vanHerkRows(const cv::Mat &src, cv::Mat &dst, int radius)
+{
+    if (radius == 0)
+    {
+        src.copyTo(dst);
+        return;
+    }
+
+    dst.create(src.rows, src.cols, src.type());
+
+    Operator op;
+
+    int cn = src.channels();
+    int n = src.cols;
+    int k = 2 * radius + 1;
+    int paddedLength = n + 2 * radius;
+
+    std::vector<uchar> neutralPixel(cn, Operator::neutral());
+
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &range)
+    {
+        std::vector<uchar> prefix(paddedLength * cn), suffix(paddedLength * cn);
+
+        for (int y = range.start; y < range.end; y++)
+        {
+            const uchar *s = src.ptr<uchar>(y);
+            uchar *d = dst.ptr<uchar>(y);
+
+            for (int j = 0; j < paddedLength; j++)
+            {
+                const uchar *p = (j < radius || j >= n + radius) ? neutralPixel.data() : s + (j - radius) * cn;
+                uchar *g = &prefix[j * cn];
+
+                if (j % k == 0)
+                    for (int c = 0; c < cn; c++) g[c] = p[c];
+                else
+                    for (int c = 0; c < cn; c++) g[c] = op(g[c - cn], p[c]);
+            }
+
+            for (int j = paddedLength - 1; j >= 0; j--)
+            {
+                const uchar *p = (j < radius || j >= n + radius) ? neutralPixel.data() : s + (j - radius) * cn;
+                uchar *h = &suffix[j * cn];
+
+                if (j % k == k - 1 || j == paddedLength - 1)
+                    for (int c = 0; c < cn; c++) h[c] = p[c];
+                else
+                    for (int c = 0; c < cn; c++) h[c] = op(h[c + cn], p[c]);
+            }
+
+            const uchar *h = suffix.data();
+            const uchar *g = prefix.data() + (k - 1) * cn;
+
+            for (int i = 0; i < n * cn; i++)
+                d[i] = op(h[i], g[i]);
+        }
+    });
+}
+
+// Same along columns, processing whole row segments at a time to stay cache friendly
+
+template <class Operator>
+static void vanHerkColumns(const cv::Mat &src, cv::Mat &dst, int radius)
+{
+    if (radius == 0)
+    {
+        src.copyTo(dst);
+        return;
+    }
+
+    dst.create(src.rows, src.cols, src.type());
+
+    Operator op;
+
+    int n = src.rows;
+    int k = 2 * radius + 1;
+    int paddedLength = n + 2 * radius;
+    int rowLength = src.cols * src.channels();
+
+    std::vector<uchar> neutralRow(rowLength, Operator::neutral());
+
+    cv::Mat prefix(paddedLength, rowLength, CV_8UC1);
+    cv::Mat suffix(paddedLength, rowLength, CV_8UC1);
+
+    int stripes = std::max(1, std::min(cv::getNumThreads() * 4, rowLength / 64));
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range)
+    {
+        int x0 = static_cast<int>(static_cast<long long>(rowLength) * range.start / stripes);
+        int x1 = static_cast<int>(static_cast<long long>(rowLength) * range.end / stripes);
+
+        for (int j = 0; j < paddedLength; j++)
+        {
+            const uchar *p = (j < radius || j >= n + radius) ? neutralRow.data() : src.ptr<uchar>(j - radius);
+            uchar *g = prefix.ptr<uchar>(j);
+
+            if (j % k == 0)
+            {
+                for (int x = x0; x < x1; x++) g[x] = p[x];
+            }
+            else
+            {
+                const uchar *gPrevious = prefix.ptr<uchar>(j - 1);
+                for (int x = x0; x < x1; x++) g[x] = op(gPrevious[x], p[x]);
+            }
+        }
+
+        for (int j = paddedLength - 1; j >= 0; j--)
+        {
+            const uchar *p = (j < radius || j >= n + radius) ? neutralRow.data() : src.ptr<uchar>(j - radius);
+            uchar *h = suffix.ptr<uchar>(j);
+
+            if (j % k == k - 1 || j == paddedLength - 1)
+            {
+                for (int x = x0; x < x1; x++) h[x] = p[x];
+            }
+            else
+            {
+                const uchar *hNext = suffix.ptr<uchar>(j + 1);
+                for (int x = x0; x < x1; x++) h[x] = op(hNext[x], p[x]);
+            }
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            const uchar *h = suffix.ptr<uchar>(i);
+            const uchar *g = prefix.ptr<uchar>(i + k - 1);
+            uchar *d = dst.ptr<uchar>(i);
+
+            for (int x = x0; x < x1; x++)
+                d[x] = op(h[x], g[x]);
+        }
+    });
+}
+
+template <class Operator>
+static void vanHerkRectUnion(const cv::Mat &src, cv::Mat &dst, const std::vector<cv::Size> &rects)
+{
+    Operator op;
+
+    cv::Mat result, rowsPass, rectPass;
+
+    int rowLength = src.cols * src.channels();
+    int rowsPassRadius = -1;
+
+    for (size_t r = 0; r < rects.size(); r++)
+    {
+        if (rects[r].width != rowsPassRadius)
+        {
+            vanHerkRows<Operator>(src, rowsPass, rects[r].width);
+            rowsPassRadius = rects[r].width;
+        }
+
+        vanHerkColumns<Operator>(rowsPass, rectPass, rects[r].height);
+
+        if (r == 0)
+        {
+            // Swap, so that the next rectangle pass gets its own buffer
+
+            std::swap(result, rectPass);
+        }
+        else
+        {
+            cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &range)
+            {
+                for (int i = range.start; i < range.end; i++)
+                {
+                    uchar *a = result.ptr<uchar>(i);
+                    const uchar *b = rectPass.ptr<uchar>(i);
+
+                    for (int x = 0; x < rowLength; x++)
+                        a[x] = op(a[x], b[x]);
+                }
+            });
+        }
+    }
+
+    dst = result;
+}
+
+void vanHerkMorphology(const cv::Mat &src, cv::Mat &dst, const std::vector<cv::Size> &rects, bool dilate)
+{
+    CV_Assert(src.depth() == CV_8U && !rects.empty());
+
+    if (dilate)
+        vanHerkRectUnion<MaxOperator>(src, dst, rects);
+    else
+        vanHerkRectUnion<MinOperator>(src, dst, rects);
+}
+
+// Young-van Vliet recursive Gaussian
+
+struct RecursiveGaussianCoefficients
+{
+    float B, a1, a2, a3;
+    int tail;
+
+    RecursiveGaussianCoefficients(double sigma)
+    {
+        double q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+
+        double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+        double b1 = 2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q;
+        double b2 = -(1.4281 * q * q + 1.26661 * q * q * q);
+        double b3 = 0.422205 * q * q * q;
+
+        a1 = static_cast<float>(b1 / b0);
+        a2 = static_cast<float>(b2 / b0);
+        a3 = static_cast<float>(b3 / b0);
+        B = 1.0f - (a1 + a2 + a3);
+
+        // The causal pass runs over this many zeros past the end, so the anticausal pass
+        // can start from a negligible state
+
+        tail = cvCeil(4.0 * sigma) + 3;
+    }
+};
+
+void recursiveGaussianBlur(const cv::Mat &src, cv::Mat &dst, double sigma)
+{
+    CV_Assert(src.depth() == CV_8U && sigma >= 0.5);
+
+    RecursiveGaussianCoefficients k(sigma);
+
+    int cn = src.channels();
+    int rowLength = src.cols * cn;
+
+    cv::Mat horizontal(src.rows, rowLength, CV_32FC1);
+
+    // Rows: out of image pixels on the left are the zero initial state, on the right the zero tail
+
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &range)
+    {
+        int length = src.cols + k.tail;
+        std::vector<float> line((length + 3) * cn, 0.0f);
+
+        for (int y = range.start; y < range.end; y++)
+        {
+            const uchar *s = src.ptr<uchar>(y);
+            float *h = horizontal.ptr<float>(y);
+
+            // Three leading zeros hold the causal initial state
+
+            float *w = line.data() + 3 * cn;
+
+            for (int i = 0; i < length; i++)
+                for (int c = 0; c < cn; c++)
+                {
+                    int n = i * cn + c;
+                    float x = i < src.cols ? s[n] : 0.0f;
+                    w[n] = k.B * x + k.a1 * w[n - cn] + k.a2 * w[n - 2 * cn] + k.a3 * w[n - 3 * cn];
+                }
+
+            // Anticausal pass in place, with zero state beyond the tail
+
+            for (int i = length - 1; i >= 0; i--)
+                for (int c = 0; c < cn; c++)
+                {
+                    int n = i * cn + c;
+                    float y1 = i + 1 < length ? w[n + cn] : 0.0f;
+                    float y2 = i + 2 < length ? w[n + 2 * cn] : 0.0f;
+                    float y3 = i + 3 < length ? w[n + 3 * cn] : 0.0f;
+                    w[n] = k.B * w[n] + k.a1 * y1 + k.a2 * y2 + k.a3 * y3;
+                }
+
+            for (int n = 0; n < rowLength; n++)
+                h[n] = w[n];
+        }
+    });
+
+    // Columns: whole row segments are filtered at a time to stay cache friendly
+
+    dst.create(src.rows, src.cols, src.type());
+
+    int stripes = std::max(1, std::min(cv::getNumThreads() * 4, rowLength / 64));
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range)
+    {
+        int x0 = static_cast<int>(static_cast<long long>(rowLength) * range.start / stripes);
+        int x1 = static_cast<int>(static_cast<long long>(rowLength) * range.end / stripes);
+        int width = x1 - x0;
+        int length = src.rows + k.tail;
+
+        cv::Mat w = cv::Mat::zeros(length + 6, width, CV_32FC1);
+
+        for (int j = 0; j < length; j++)
+        {
+            float *w0 = w.ptr<float>(j + 3);
+            const float *w1 = w.ptr<float>(j + 2);
+            const float *w2 = w.ptr<float>(j + 1);
+            const float *w3 = w.ptr<float>(j);
+
+            if (j < src.rows)
+            {
+                const float *h = horizontal.ptr<float>(j) + x0;
+                for (int x = 0; x < width; x++)
+                    w0[x] = k.B * h[x] + k.a1 * w1[x] + k.a2 * w2[x] + k.a3 * w3[x];
+            }
+            else
+            {
+                for (int x = 0; x < width; x++)
+                    w0[x] = k.a1 * w1[x] + k.a2 * w2[x] + k.a3 * w3[x];
+            }
+        }
+
+        // Rows past the tail are zero, the anticausal state
+
+        for (int j = length - 1; j >= 0; j--)
+        {
+            float *y0 = w.ptr<float>(j + 3);
+            const float *y1 = w.ptr<float>(j + 4);
+            const float *y2 = w.ptr<float>(j + 5);
+            const float *y3 = w.ptr<float>(j + 6);
+
+            if (j == length - 1)
+                y1 = y2 = y3 = w.ptr<float>(0);
+
+            for (int x = 0; x < width; x++)
+                y0[x] = k.B * y0[x] + k.a1 * y1[x] + k.a2 * y2[x] + k.a3 * y3[x];
+
+            if (j < src.rows)
+            {
+                uchar *d = dst.ptr<uchar>(j) + x0;
+                for (int x = 0; x < width; x++)
+                    d[x] = cv::saturate_cast<uchar>(y0[x]);
+            }
+        }
+    });
+}
+
+// Domain transform recursive filter
+
+void domainTransformFilter(const cv::Mat &src, cv::Mat &dst, double sigmaSpace, double sigmaColor)
+{
+    CV_Assert(src.depth() == CV_8U);
+
+    // Same conventions as cv::bilateralFilter for nonpositive sigmas
+
+    if (sigmaSpace <= 0.0) sigmaSpace = 1.0;
+    if (sigmaColor <= 0.0) sigmaColor = 1.0;
+
+    const int iterations = 3;
+
+    int cn = src.channels();
+    int rowLength = src.cols * cn;
+    int maxDistance = 255 * cn;
+
+    // L1 color distances to the left and upper neighbours, which index the weight tables
+
+    cv::Mat distanceH(src.rows, src.cols, CV_16UC1), distanceV(src.rows, src.cols, CV_16UC1);
+    cv::Mat J(src.rows, rowLength, CV_32FC1);
+
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &range)
+    {
+        for (int y = range.start; y < range.end; y++)
+        {
+            const uchar *s = src.ptr<uchar>(y);
+            const uchar *up = src.ptr<uchar>(y > 0 ? y - 1 : y);
+            ushort *dh = distanceH.ptr<ushort>(y);
+            ushort *dv = distanceV.ptr<ushort>(y);
+            float *j = J.ptr<float>(y);
+
+            for (int x = 0; x < src.cols; x++)
+            {
+                int h = 0, v = 0;
+                for (int c = 0; c < cn; c++)
+                {
+                    int n = x * cn + c;
+                    if (x > 0) h += std::abs(s[n] - s[n - cn]);
+                    v += std::abs(s[n] - up[n]);
+                    j[n] = s[n];
+                }
+                dh[x] = static_cast<ushort>(h);
+                dv[x] = static_cast<ushort>(v);
+            }
+        }
+    });
+
+    std::vector<float> weights(maxDistance + 1);
+
+    int stripes = std::max(1, std::min(cv::getNumThreads() * 4, rowLength / 64));
+
+    for (int i = 0; i < iterations; i++)
+    {
+        // Sigma of this iteration, so that the total variance matches sigmaSpace
+
+        double sigmaH = sigmaSpace * sqrt(3.0) * pow(2.0, iterations - i - 1) / sqrt(pow(4.0, iterations) - 1.0);
+        double a = exp(-sqrt(2.0) / sigmaH);
+
+        for (int k = 0; k <= maxDistance; k++)
+            weights[k] = static_cast<float>(pow(a, 1.0 + sigmaSpace / sigmaColor * k));
+
+        const float *w = weights.data();
+
+        // Horizontal pass
+
+        cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &range)
+        {
+            for (int y = range.start; y < range.end; y++)
+            {
+                const ushort *d = distanceH.ptr<ushort>(y);
+                float *j = J.ptr<float>(y);
+
+                for (int x = 1; x < src.cols; x++)
+                {
+                    float wx = w[d[x]];
+                    for (int c = 0; c < cn; c++)
+                        j[x * cn + c] += wx * (j[(x - 1) * cn + c] - j[x * cn + c]);
+                }
+
+                for (int x = src.cols - 2; x >= 0; x--)
+                {
+                    float wx = w[d[x + 1]];
+                    for (int c = 0; c < cn; c++)
+                        j[x * cn + c] += wx * (j[(x + 1) * cn + c] - j[x * cn + c]);
+                }
+            }
+        });
+
+        // Vertical pass, sweeping whole row segments of a column stripe
+
+        cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range)
+        {
+            int x0 = src.cols * range.start / stripes;
+            int x1 = src.cols * range.end / stripes;
+
+            for (int y = 1; y < src.rows; y++)
+            {
+                const ushort *d = distanceV.ptr<ushort>(y);
+                const float *previous = J.ptr<float>(y - 1);
+                float *j = J.ptr<float>(y);
+
+                for (int x = x0; x < x1; x++)
+                {
+                    float wy = w[d[x]];
+                    for (int c = 0; c < cn; c++)
+                        j[x * cn + c] += wy * (previous[x * cn + c] - j[x * cn + c]);
+                }
+            }
+
+            for (int y = src.rows - 2; y >= 0; y--)
+            {
+                const ushort *d = distanceV.ptr<ushort>(y + 1);
+                const float *next = J.ptr<float>(y + 1);
+                float *j = J.ptr<float>(y);
+
+                for (int x = x0; x < x1; x++)
+                {
+                    float wy = w[d[x]];
+                    for (int c = 0; c < cn; c++)
+                        j[x * cn + c] += wy * (next[x * cn + c] - j[x * cn + c]);
+                }
+            }
+        });
+    }
+
+    dst.create(src.rows, src.cols, src.type());
+
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &range)
+    {
+        for (int y = range.start; y < range.end; y++)
+        {
+            const float *j = J.ptr<float>(y);
+            uchar *d = dst.ptr<uchar>(y);
+            for (int n = 0; n < rowLength; n++)
+                d[n] = cv::saturate_cast<uchar>(j[n]);
+        }
+    });
+}
+
+// Unsharp mask
+
+// Same arithmetic as the matrix expressions it replaces: saturating difference, comparison against the threshold
+// rounded up (as cv::compare does for integer images), and cv::addWeighted itself, run on a band still in cache
+
+static void unsharpMaskBand(const cv::Mat &src, const cv::Mat &blurred, cv::Mat &sharpened, cv::Mat dst, int limit, double amount)
+{
+    cv::addWeighted(src, 1.0 + amount, blurred, -amount, 0.0, sharpened);
+
+    int rowLength = src.cols * src.channels();
+
+    for (int y = 0; y < src.rows; y++)
+    {
+        const uchar *s = src.ptr<uchar>(y);
+        const uchar *b = blurred.ptr<uchar>(y);
+        const uchar *h = sharpened.ptr<uchar>(y);
+        uchar *d = dst.ptr<uchar>(y);
+
+        for (int n = 0; n < rowLength; n++)
+            d[n] = std::max(s[n] - b[n], 0) < limit ? s[n] : h[n];
+    }
+}
+
+void unsharpMask(const cv::Mat &src, cv::Mat &dst, double sigma, double threshold, double amount, bool recursive)
+{
+    CV_Assert(src.depth() == CV_8U);
+
+    int limit = static_cast<int>(std::min(std::max(ceil(threshold), 0.0), 256.0));
+
+    const int bandHeight = 32;
+    int bands = (src.rows + bandHeight - 1) / bandHeight;
+
+    cv::Mat result(src.rows, src.cols, src.type());
+
+    if (recursive)
+    {
+        // The recursive filter runs over whole rows and columns, so only the combination is banded
+
+        cv::Mat blurred;
+        recursiveGaussianBlur(src, blurred, sigma);
+
+        cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &range)
+        {
+            cv::Mat sharpened;
+
+            for (int band = range.start; band < range.end; band++)
+            {
+                int y0 = band * bandHeight;
+                int y1 = std::min(y0 + bandHeight, src.rows);
+
+                unsharpMaskBand(src.rowRange(y0, y1), blurred.rowRange(y0, y1), sharpened, result.rowRange(y0, y1), limit, amount);
+            }
+        });
+    }
+    else
+    {
+        // Without cv::BORDER_ISOLATED, filtering a band reads the rows above and below it from the parent image,
+        // while out of image pixels are still zero: the blurred band equals the same rows of a whole-frame blur
+
+        cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &range)
+        {
+            cv::Mat blurred, sharpened;
+
+            for (int band = range.start; band < range.end; band++)
+            {
+                int y0 = band * bandHeight;
+                int y1 = std::min(y0 + bandHeight, src.rows);
+
+                cv::GaussianBlur(src.rowRange(y0, y1), blurred, cv::Size(), sigma, sigma, cv::BORDER_CONSTANT);
+
+                unsharpMaskBand(src.rowRange(y0, y1), blurred, sharpened, result.rowRange(y0, y1), limit, amount);
+            }
+        });
+    }
+
+    dst = result;
+}
+
+// Banded median
+
+void bandedMedianBlur(const cv::Mat &src, cv::Mat &dst, int ksize)
+{
+    int radius = ksize / 2;
+
+    // Halos add 2 * radius rows to every band, so bands are kept at least that high
+
+    int bands = std::min(cv::getNumThreads(), src.rows / std::max(2 * radius, 1));
+
+    if (bands <= 1)
+    {
+        cv::medianBlur(src, dst, ksize);
+        return;
+    }
+
+    // cv::medianBlur replicates the rows at the edges of the matrix it is given: inner band edges are
+    // covered by halo rows of the parent image, outer ones are the image's own edges, as for the whole frame
+
+    cv::Mat result(src.rows, src.cols, src.type());
+
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &range)
+    {
+        cv::Mat filtered;
+
+        for (int band = range.start; band < range.end; band++)
+        {
+            int y0 = src.rows * band / bands;
+            int y1 = src.rows * (band + 1) / bands;
+
+            int top = std::max(y0 - radius, 0);
+            int bottom = std::min(y1 + radius, src.rows);
+
+            cv::medianBlur(src.rowRange(top, bottom), filtered, ksize);
+            filtered.rowRange(y0 - top, y1 - top).copyTo(result.rowRange(y0, y1));
+        }
+    });
+
+    dst = result;
+}
+
+// Tiled execution
+
+void tiledApply(cv::Mat &image, int halo, const std::function<void(cv::Mat&)> &function, int minTiles)
+{
+    const size_t tileBytes = 1 << 20;
+
+    // Halos add 2 * halo rows to every tile, so tiles are kept at least that high
+
+    size_t bytes = image.total() * image.elemSize();
+    size_t sizeTiles = std::max(bytes / tileBytes, static_cast<size_t>(std::max(minTiles, 0)));
+    int tiles = static_cast<int>(std::min(sizeTiles, static_cast<size_t>(image.rows / std::max(2 * halo, 1))));
+
+    if (tiles <= 1)
+    {
+        function(image);
+        return;
+    }
+
+    if (halo == 0)
+    {
+        cv::parallel_for_(cv::Range(0, tiles), [&](const cv::Range &range)
+        {
+            for (int t = range.start; t < range.end; t++)
+            {
+                cv::Mat band = image.rowRange(image.rows * t / tiles, image.rows * (t + 1) / tiles);
+                cv::Mat tile = band;
+
+                function(tile);
+
+                // The function may have assigned a new matrix instead of writing in place
+
+                if (tile.data != band.data)
+                    tile.copyTo(band);
+            }
+        });
+
+        return;
+    }
+
+    // Neighborhood functions read from the input frame and write to a new one
+
+    cv::Mat result(image.rows, image.cols, image.type());
+
+    cv::parallel_for_(cv::Range(0, tiles), [&](const cv::Range &range)
+    {
+        for (int t = range.start; t < range.end; t++)
+        {
+            int y0 = image.rows * t / tiles;
+            int y1 = image.rows * (t + 1) / tiles;
+
+            int top = std::max(y0 - halo, 0);
+            int bottom = std::min(y1 + halo, image.rows);
+
+            cv::Mat tile = image.rowRange(top, bottom).clone();
+
+            function(tile);
+
+            tile.rowRange(y0 - top, y1 - top).copyTo(result.rowRange(y0, y1));
+        }
+    });
+
+    image = result;
+}
+
+// Linear filter
+
+cv::Mat composeKernels(const cv::Mat &a, const cv::Mat &b)
+{
+    int size = a.rows + b.rows - 1;
+    cv::Mat c = cv::Mat::zeros(size, size, CV_32F);
+
+    for (int i = 0; i < a.rows; i++)
+        for (int j = 0; j < a.cols; j++)
+            for (int k = 0; k < b.rows; k++)
+                for (int l = 0; l < b.cols; l++)
+                    c.at<float>(i + k, j + l) += a.at<float>(i, j) * b.at<float>(k, l);
+
+    return c;
+}
+
+double LinearFilter::estimateCost(int size, bool separable)
+{
+    // Same path choice as setKernel, except that small separable kernels are taken as direct
+
+    if (size <= 5)
+        return size * size;
+    else if (separable)
+        return 2.0 * size;
+    else if (size >= 11)
+        return 100.0;
+    else
+        return size * size;
+}
+
+void LinearFilter::setKernel(const cv::Mat &theKernel)
+{
+    CV_Assert(theKernel.rows == theKernel.cols && theKernel.rows % 2 == 1);
+
+    theKernel.convertTo(kernel, CV_32F);
+    kernelSpectrum.release();
+
+    int size = kernel.rows;
+
+    // Fixed point: weights must be multiples of 2^-shift, and sums must stay exact in float,
+    // as cv::filter2D accumulates in float, so that both results are identical
+
+    if (size <= 5)
+    {
+        for (shift = 0; shift <= 8; shift++)
+        {
+            bool exact = true;
+            double absoluteSum = 0.0;
+
+            integerKernel.resize(size * size);
+
+            for (int i = 0; i < size * size; i++)
+            {
+                double scaled = kernel.at<float>(i / size, i % size) * (1 << shift);
+                integerKernel[i] = cvRound(scaled);
+                absoluteSum += fabs(scaled);
+
+                if (fabs(scaled - integerKernel[i]) > 1.0e-6)
+                {
+                    exact = false;
+                    break;
+                }
+            }
+
+            if (exact && absoluteSum * 255.0 < (1 << 24))
+            {
+                path = PATH_FIXED_POINT;
+                return;
+            }
+        }
+    }
+
+    // Rank one kernels factor as the outer product of a column and a row
+
+    if (size >= 5)
+    {
+        cv::Mat w, u, vt;
+        cv::SVD::compute(kernel, w, u, vt);
+
+        float w0 = w.at<float>(0);
+        if (w0 > 0.0f && w.at<float>(1) <= 1.0e-6f * w0)
+        {
+            kernelX = vt.row(0) * sqrt(w0);
+            kernelY = u.col(0) * sqrt(w0);
+            path = PATH_SEPARABLE;
+            return;
+        }
+    }
+
+    path = size >= 11 ? PATH_FFT : PATH_DIRECT;
+}
+
+void LinearFilter::apply(const cv::Mat &src, cv::Mat &dst)
+{
+    CV_Assert(src.depth() == CV_8U && !kernel.empty());
+
+    if (path == PATH_FIXED_POINT)
+        applyFixedPoint(src, dst);
+    else if (path == PATH_SEPARABLE)
+        cv::sepFilter2D(src, dst, -1, kernelX, kernelY, cv::Point(-1, -1), 0.0, cv::BORDER_ISOLATED);
+    else if (path == PATH_FFT && src.rows >= 2 * kernel.rows && src.cols >= 2 * kernel.rows)
+        applyFFT(src, dst);
+    else
+        cv::filter2D(src, dst, -1, kernel, cv::Point(-1, -1), 0.0, cv::BORDER_ISOLATED);
+}
+
+// Integer multiply-accumulate over whole rows, with zero padding so that the inner loops have no branches
+// and vectorize, followed by division by 2^shift rounding half to even, as cvRound does
+
+void LinearFilter::applyFixedPoint(const cv::Mat &src, cv::Mat &dst)
+{
+    int size = kernel.rows;
+    int radius = size / 2;
+    int cn = src.channels();
+    int rowLength = src.cols * cn;
+    int paddedLength = rowLength + 2 * radius * cn;
+
+    cv::Mat padded = cv::Mat::zeros(src.rows + 2 * radius, paddedLength, CV_8UC1);
+    for (int y = 0; y < src.rows; y++)
+        memcpy(padded.ptr<uchar>(y + radius) + radius * cn, src.ptr<uchar>(y), rowLength);
+
+    dst.create(src.rows, src.cols, src.type());
+
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &range)
+    {
+        std::vector<int> accumulator(rowLength);
+        int *acc = accumulator.data();
+
+        for (int y = range.start; y < range.end; y++)
+        {
+            std::fill(accumulator.begin(), accumulator.end(), 0);
+
+            for (int i = 0; i < size; i++)
+            {
+                const uchar *p = padded.ptr<uchar>(y + i);
+
+                for (int j = 0; j < size; j++)
+                {
+                    int k = integerKernel[i * size + j];
+                    if (k == 0) continue;
+
+                    const uchar *q = p + j * cn;
+                    for (int n = 0; n < rowLength; n++)
+                        acc[n] += k * q[n];
+                }
+            }
+
+            uchar *d = dst.ptr<uchar>(y);
+
+            if (shift == 0)
+            {
+                for (int n = 0; n < rowLength; n++)
+                    d[n] = cv::saturate_cast<uchar>(acc[n]);
+            }
+            else
+            {
+                int half = 1 << (shift - 1);
+                int mask = (1 << shift) - 1;
+
+                for (int n = 0; n < rowLength; n++)
+                {
+                    int quotient = acc[n] >> shift;
+                    int remainder = acc[n] & mask;
+                    quotient += (remainder > half) | ((remainder == half) & quotient & 1);
+                    d[n] = cv::saturate_cast<uchar>(quotient);
+                }
+            }
+        }
+    });
+}
+
+// Zero padding to at least the image plus the kernel size makes the cyclic convolution linear,
+// which matches the zero border. The flipped kernel turns the convolution into a correlation
+
+void LinearFilter::applyFFT(const cv::Mat &src, cv::Mat &dst)
+{
+    int size = kernel.rows;
+    int radius = size / 2;
+    int cn = src.channels();
+
+    cv::Size dftSize(cv::getOptimalDFTSize(src.cols + size - 1), cv::getOptimalDFTSize(src.rows + size - 1));
+
+    if (kernelSpectrum.empty() || spectrumSize != dftSize)
+    {
+        cv::Mat flipped;
+        cv::flip(kernel, flipped, -1);
+
+        kernelSpectrum = cv::Mat::zeros(dftSize, CV_32FC1);
+        flipped.copyTo(kernelSpectrum(cv::Rect(0, 0, size, size)));
+        cv::dft(kernelSpectrum, kernelSpectrum, 0, size);
+
+        spectrumSize = dftSize;
+    }
+
+    std::vector<cv::Mat> channels;
+    cv::split(src, channels);
+
+    planes.resize(cn);
+
+    cv::parallel_for_(cv::Range(0, cn), [&](const cv::Range &range)
+    {
+        for (int c = range.start; c < range.end; c++)
+        {
+            cv::Mat &plane = planes[c];
+            plane.create(dftSize, CV_32FC1);
+            plane.setTo(cv::Scalar::all(0));
+
+            channels[c].convertTo(plane(cv::Rect(0, 0, src.cols, src.rows)), CV_32F);
+
+            cv::dft(plane, plane, 0, src.rows);
+            cv::mulSpectrums(plane, kernelSpectrum, plane, 0);
+            cv::dft(plane, plane, cv::DFT_INVERSE | cv::DFT_SCALE, src.rows + radius);
+
+            plane(cv::Rect(radius, radius, src.cols, src.rows)).convertTo(channels[c], CV_8U);
+        }
+    });
+
+    cv::merge(channels, dst);
+}
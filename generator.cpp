@@ -16,6 +16,56 @@
 // along with MorphogenCV.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "generator.h"
+#include <chrono>
+
+// Operation cost model
+
+double OperationCostModel::getCoefficient(const std::string &name)
+{
+    // Milliseconds per megapixel and unit of cost factor, a guess until the type has been timed
+
+    auto it = coefficients.find(name);
+    return it != coefficients.end() ? it->second : 2.0;
+}
+
+double OperationCostModel::estimate(ImageOperation *operation, cv::Size size)
+{
+    return getCoefficient(operation->getName()) * size.area() * 1.0e-6 * operation->getCostFactor();
+}
+
+double OperationCostModel::estimate(const std::vector<ImageOperation*> &operations, cv::Size size)
+{
+    double milliseconds = 0.0;
+
+    for (auto operation: operations)
+        milliseconds += estimate(operation, size);
+
+    return milliseconds;
+}
+
+void OperationCostModel::calibrate(const std::vector<ImageOperation*> &operations, cv::Size size, double milliseconds)
+{
+    double estimated = estimate(operations, size);
+
+    if (estimated <= 0.0)
+        return;
+
+    // The measurement is shared out in proportion to the estimates, and each coefficient moves a tenth of the way
+
+    double ratio = milliseconds / estimated;
+
+    std::map<std::string, double> calibrated;
+
+    for (auto operation: operations)
+        calibrated[operation->getName()] = getCoefficient(operation->getName()) * (0.9 + 0.1 * ratio);
+
+    for (auto &coefficient: calibrated)
+        coefficients[coefficient.first] = coefficient.second;
+}
+
+// Pipeline
+
+OperationCostModel Pipeline::costModel;
 
 Pipeline::Pipeline(cv::Mat img): image(img)
 {
@@ -51,13 +101,314 @@ Pipeline::~Pipeline()
 {
     for (auto operation: imageOperations)
         delete operation;
+
+    for (auto operation: fusedOperations)
+        delete operation;
+
+    for (auto operation: fusedColorOperations)
+        delete operation;
 }
 
 void Pipeline::iterate()
 {
+    // The frame stays planar between operations that prefer planes, and is converted only when the layout changes
+
+    std::vector<cv::Mat> planes;
+    bool planar = false;
+
+    // Likewise for the color space: operations in the same space as the frame run without conversions
+    // Planes and linear operations are always BGR
+
+    FrameColorSpace colorSpace = COLOR_SPACE_BGR;
+
+    // Runs of consecutive tileable operations are deferred and then executed together, tile by tile (see tiledApply)
+    // Each tile is extended by the sum of their halos and goes through all of them while in cache
+    // Global operations end the run and work on the whole frame
+
+    std::vector<ImageOperation*> band;
+    std::vector<FrameColorSpace> bandSpaces;
+    int bandHalo = 0;
+
+    // Every execution is timed to calibrate the cost model of the operations involved
+
+    auto profile = [&](const std::vector<ImageOperation*> &operations, const std::function<void()> &function)
+    {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        auto end = std::chrono::steady_clock::now();
+
+        costModel.calibrate(operations, image.size(), std::chrono::duration<double, std::milli>(end - start).count());
+    };
+
+    auto applyBand = [&]()
+    {
+        if (band.empty())
+            return;
+
+        FrameColorSpace startSpace = colorSpace;
+
+        auto applyToTile = [&](cv::Mat &tile)
+        {
+            FrameColorSpace space = startSpace;
+
+            for (size_t i = 0; i < band.size(); i++)
+            {
+                convertColorSpace(tile, space, bandSpaces[i]);
+                space = bandSpaces[i];
+
+                if (space != COLOR_SPACE_BGR)
+                    band[i]->applyOperationInColorSpace(tile);
+                else
+                    band[i]->applyOperation(tile);
+            }
+        };
+
+        // Runs estimated to be expensive are split into several tiles per thread, so that they are balanced
+        // Each tile recomputes 2 * halo rows, so tiles are kept at least 8 halos high (at most 25% more work)
+
+        int minTiles = 0;
+
+        if (costModel.estimate(band, image.size()) >= 2.0)
+        {
+            minTiles = 4 * cv::getNumThreads();
+
+            if (bandHalo > 0)
+                minTiles = std::min(minTiles, image.rows / (8 * bandHalo));
+        }
+
+        profile(band, [&](){ tiledApply(image, bandHalo, applyToTile, minTiles); });
+
+        colorSpace = bandSpaces.back();
+
+        band.clear();
+        bandSpaces.clear();
+        bandHalo = 0;
+    };
+
+    // The band is always empty while the frame is planar
+
+    auto toInterleaved = [&]()
+    {
+        if (planar)
+        {
+            cv::merge(planes, image);
+            planar = false;
+        }
+    };
+
+    auto toPlanar = [&]()
+    {
+        applyBand();
+
+        if (!planar)
+        {
+            cv::split(image, planes);
+            planar = true;
+        }
+    };
+
+    auto toColorSpace = [&](FrameColorSpace space)
+    {
+        applyBand();
+
+        if (colorSpace != space)
+        {
+            toInterleaved();
+            convertColorSpace(image, colorSpace, space);
+            colorSpace = space;
+        }
+    };
+
+    auto addToBand = [&](ImageOperation *operation)
+    {
+        int halo = operation->getHalo();
+
+        if (halo < 0)
+            return false;
+
+        toInterleaved();
+
+        band.push_back(operation);
+        bandSpaces.push_back(operation->getColorSpace());
+        bandHalo += halo;
+
+        return true;
+    };
+
+    // Operations run one by one in their color space and layout, unless they join the band
+
+    auto applyOperation = [&](ImageOperation *operation)
+    {
+        FrameColorSpace space = operation->getColorSpace();
+        FrameLayout layout = operation->getLayout();
+
+        bool planarLayout = space == COLOR_SPACE_BGR && (layout == LAYOUT_PLANAR || (layout == LAYOUT_ANY && planar));
+
+        if (!planarLayout && addToBand(operation))
+            return;
+
+        if (space != COLOR_SPACE_BGR)
+        {
+            toColorSpace(space);
+            profile({operation}, [&](){ operation->applyOperationInColorSpace(image); });
+        }
+        else if (planarLayout)
+        {
+            toColorSpace(COLOR_SPACE_BGR);
+            toPlanar();
+            profile({operation}, [&](){ operation->applyOperationPlanar(planes); });
+        }
+        else
+        {
+            toColorSpace(COLOR_SPACE_BGR);
+            toInterleaved();
+            profile({operation}, [&](){ operation->applyOperation(image); });
+        }
+    };
+
+    auto applyInterleaved = [&](ImageOperation *operation)
+    {
+        if (!addToBand(operation))
+        {
+            toColorSpace(COLOR_SPACE_BGR);
+            toInterleaved();
+            profile({operation}, [&](){ operation->applyOperation(image); });
+        }
+    };
+
+    // Runs of consecutive linear operations are fused into a single pass while within tolerance
+
+    std::vector<ImageOperation*> chain;
+    std::vector<cv::Mat> kernels;
+    std::vector<bool> absolutes;
+
+    size_t fusedIndex = 0;
+
+    auto applyChain = [&]()
+    {
+        if (chain.size() == 1)
+        {
+            applyInterleaved(chain[0]);
+        }
+        else if (chain.size() > 1)
+        {
+            if (fusedIndex == fusedOperations.size())
+                fusedOperations.push_back(new FusedLinearFilter());
+
+            fusedOperations[fusedIndex]->setOperations(chain, kernels, absolutes.back());
+            applyInterleaved(fusedOperations[fusedIndex]);
+            fusedIndex++;
+        }
+
+        chain.clear();
+        kernels.clear();
+        absolutes.clear();
+    };
+
+    // Runs of consecutive affine color operations are composed into a single matrix, also within tolerance
+
+    std::vector<ImageOperation*> colorChain;
+    std::vector<cv::Mat> matrices;
+
+    size_t fusedColorIndex = 0;
+
+    auto applyColorChain = [&]()
+    {
+        if (colorChain.size() == 1)
+        {
+            applyOperation(colorChain[0]);
+        }
+        else if (colorChain.size() > 1)
+        {
+            if (fusedColorIndex == fusedColorOperations.size())
+                fusedColorOperations.push_back(new FusedColorMatrix());
+
+            fusedColorOperations[fusedColorIndex]->setMatrices(matrices);
+
+            // A chain whose matrices do not reproduce it is applied unfused
+
+            if (fusedColorOperations[fusedColorIndex]->matchesChain(colorChain))
+            {
+                applyInterleaved(fusedColorOperations[fusedColorIndex]);
+            }
+            else
+            {
+                for (auto operation: colorChain)
+                    applyOperation(operation);
+            }
+
+            fusedColorIndex++;
+        }
+
+        colorChain.clear();
+        matrices.clear();
+    };
+
     for (auto operation: imageOperations)
-        if (operation->isEnabled())
-            operation->applyOperation(image);
+    {
+        if (!operation->isEnabled())
+            continue;
+
+        operation->prepareFrame();
+
+        cv::Mat kernel, matrix;
+        bool absolute = false;
+
+        // Operations preferring planes stay out of the linear chain while the frame is already planar and nothing
+        // is pending, so that they run on the planes instead of forcing a merge
+
+        bool keepPlanar = planar && chain.empty() && colorChain.empty() && operation->getLayout() == LAYOUT_PLANAR;
+
+        if (!keepPlanar && operation->getLinearKernel(kernel, absolute))
+        {
+            applyColorChain();
+
+            chain.push_back(operation);
+            kernels.push_back(kernel);
+            absolutes.push_back(absolute);
+
+            // The cheap cost check goes first, the tolerance check composes kernels
+
+            if (chain.size() > 1 && (!FusedLinearFilter::worthFusing(chain, kernels) || !FusedLinearFilter::withinTolerance(kernels, absolutes)))
+            {
+                chain.pop_back();
+                kernels.pop_back();
+                absolutes.pop_back();
+
+                applyChain();
+
+                chain.push_back(operation);
+                kernels.push_back(kernel);
+                absolutes.push_back(absolute);
+            }
+        }
+        else if (operation->getColorMatrix(matrix))
+        {
+            applyChain();
+
+            matrices.push_back(matrix);
+
+            if (colorChain.size() > 0 && !FusedColorMatrix::withinTolerance(matrices))
+            {
+                matrices.pop_back();
+                applyColorChain();
+                matrices.push_back(matrix);
+            }
+
+            colorChain.push_back(operation);
+        }
+        else
+        {
+            applyChain();
+            applyColorChain();
+            applyOperation(operation);
+        }
+    }
+
+    applyChain();
+    applyColorChain();
+    toColorSpace(COLOR_SPACE_BGR);
+    toInterleaved();
 }
 
 void Pipeline::swapImageOperations(int operationIndex0, int operationIndex1)
@@ -80,106 +431,114 @@ void Pipeline::removeImageOperation(int operationIndex)
     }
 }
 
-void Pipeline::insertImageOperation(int newOperationIndex, int currentOperationIndex)
+ImageOperation* Pipeline::newImageOperation(std::string operationName)
 {
-    std::vector<ImageOperation*>::iterator it = imageOperations.begin();
-
-    std::string operationName = availableImageOperations[newOperationIndex];
+    ImageOperation *operation = nullptr;
 
     if (operationName == BilateralFilter::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new BilateralFilter(false, 3, 50, 50));
+        operation = new BilateralFilter(false, 3, 50, 50, 0);
     }
     else if (operationName == BlendPreviousImages::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new BlendPreviousImages(false, 0, 0.0));
+        operation = new BlendPreviousImages(false, 0, 0.0);
     }
     else if (operationName == Blur::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new Blur(false, 3));
+        operation = new Blur(false, 3);
     }
     else if (operationName == Canny::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new Canny(false, 100, 300, 3, false));
+        operation = new Canny(false, 100, 300, 3, false);
     }
     else if (operationName == ColorQuantization::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new ColorQuantization(false, 255, 179, 255, 255, 0));
+        operation = new ColorQuantization(false, 255, 179, 255, 255, 0);
     }
     else if (operationName == ConvertTo::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new ConvertTo(false, 1.0, 0.0));
+        operation = new ConvertTo(false, 1.0, 0.0);
     }
     else if (operationName == DeblurFilter::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new DeblurFilter(false, 1.0, 1000.0));
+        operation = new DeblurFilter(false, 1.0, 1000.0);
     }
     else if (operationName == EqualizeHist::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new EqualizeHist(false));
+        operation = new EqualizeHist(false);
     }
     else if (operationName == Filter2D::name)
     {
         std::vector<float> kernel = {0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 0.0};
-        imageOperations.insert(it + currentOperationIndex + 1, new Filter2D(false, kernel));
+        operation = new Filter2D(false, kernel);
     }
     else if (operationName == GammaCorrection::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new GammaCorrection(false, 1.0));
+        operation = new GammaCorrection(false, 1.0);
     }
     else if (operationName == GaussianBlur::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new GaussianBlur(false, 3, 1.0));
+        operation = new GaussianBlur(false, 3, 1.0, 2);
     }
     else if (operationName == InvertColors::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new InvertColors(false));
+        operation = new InvertColors(false);
     }
     else if (operationName == Laplacian::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new Laplacian(false, 3));
+        operation = new Laplacian(false, 3);
     }
     else if (operationName == MedianBlur::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new MedianBlur(false, 3));
+        operation = new MedianBlur(false, 3);
     }
     else if (operationName == SwapChannels::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new SwapChannels(false, 0, 1, 2));
+        operation = new SwapChannels(false, 0, 1, 2);
     }
     else if (operationName == MixBGRChannels::name)
     {
         std::vector<float> kernel = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
-        imageOperations.insert(it + currentOperationIndex + 1, new MixBGRChannels(false, kernel));
+        operation = new MixBGRChannels(false, kernel);
     }
     else if (operationName == MorphologyEx::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new MorphologyEx(false, 3, 1, cv::MORPH_ERODE, cv::MORPH_RECT));
+        operation = new MorphologyEx(false, 3, 1, cv::MORPH_ERODE, cv::MORPH_RECT);
     }
     else if (operationName == Pixelate::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new Pixelate(false, 1));
+        operation = new Pixelate(false, 1);
     }
     else if (operationName == RadialRemap::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new RadialRemap(false, 0.0, 0, cv::INTER_NEAREST));
+        operation = new RadialRemap(false, 0.0, 0, cv::INTER_NEAREST);
     }
     else if (operationName == Rotation::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new Rotation(false, 0.0, 1.0, cv::INTER_NEAREST));
+        operation = new Rotation(false, 0.0, 1.0, cv::INTER_NEAREST);
     }
     else if (operationName == Saturate::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new Saturate(false, 1.0, 0.0));
+        operation = new Saturate(false, 1.0, 0.0);
     }
     else if (operationName == Sharpen::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new Sharpen(false, 1.0, 5.0, 1.0));
+        operation = new Sharpen(false, 1.0, 5.0, 1.0, 2);
     }
     else if (operationName == ShiftHue::name)
     {
-        imageOperations.insert(it + currentOperationIndex + 1, new ShiftHue(false, 0));
+        operation = new ShiftHue(false, 0);
     }
+
+    return operation;
+}
+
+void Pipeline::insertImageOperation(int newOperationIndex, int currentOperationIndex)
+{
+    ImageOperation *operation = newImageOperation(availableImageOperations[newOperationIndex]);
+
+    if (operation)
+        imageOperations.insert(imageOperations.begin() + currentOperationIndex + 1, operation);
 }
 
 void Pipeline::loadImageOperation(
@@ -195,7 +554,7 @@ void Pipeline::loadImageOperation(
 {
     if (operationName == BilateralFilter::name)
     {
-        imageOperations.push_back(new BilateralFilter(enabled, intParameters[0], doubleParameters[0], doubleParameters[1]));
+        imageOperations.push_back(new BilateralFilter(enabled, intParameters[0], doubleParameters[0], doubleParameters[1], intParameters.size() > 1 ? intParameters[1] : 0));
     }
     else if (operationName == BlendPreviousImages::name)
     {
@@ -235,7 +594,7 @@ void Pipeline::loadImageOperation(
     }
     else if (operationName == GaussianBlur::name)
     {
-        imageOperations.push_back(new GaussianBlur(enabled, intParameters[0], doubleParameters[0]));
+        imageOperations.push_back(new GaussianBlur(enabled, intParameters[0], doubleParameters[0], intParameters.size() > 1 ? intParameters[1] : 0));
     }
     else if (operationName == InvertColors::name)
     {
@@ -283,7 +642,7 @@ void Pipeline::loadImageOperation(
     }
     else if (operationName == Sharpen::name)
     {
-        imageOperations.push_back(new Sharpen(enabled, doubleParameters[0], doubleParameters[1], doubleParameters[2]));
+        imageOperations.push_back(new Sharpen(enabled, doubleParameters[0], doubleParameters[1], doubleParameters[2], intParameters.empty() ? 0 : intParameters[0]));
     }
     else if (operationName == ShiftHue::name)
     {
@@ -320,14 +679,22 @@ GeneratorCV::GeneratorCV()
         SwapChannels::name
     };
 
-    imageSize = 700;
+    // Default instances, kept for cost estimates
+
+    for (auto name: availableImageOperations)
+        defaultImageOperations.push_back(Pipeline::newImageOperation(name));
 
-    colorScaleFactor = 1.0 / (imageSize * imageSize * 255);
+    imageWidth = 700;
+    imageHeight = 700;
+
+    colorScaleFactor = 1.0 / (imageWidth * imageHeight * 255);
 
     histogramSize = 256;
 
     iteration = 0;
 
+    outputImageShared = false;
+
     selectingPixel = false;
 
     drawingPointer = false;
@@ -351,9 +718,9 @@ GeneratorCV::GeneratorCV()
     drawRandomSeed(false);
     clearPointerCanvas();
 
-    outputPipeline = new Pipeline(cv::Mat::zeros(imageSize, imageSize, CV_8UC3));
+    outputPipeline = new Pipeline(cv::Mat::zeros(imageHeight, imageWidth, CV_8UC3));
 
-    selectedPixel = cv::Point(imageSize / 2, imageSize / 2);
+    selectedPixel = cv::Point(imageWidth / 2, imageHeight / 2);
 }
 
 GeneratorCV::~GeneratorCV()
@@ -364,6 +731,9 @@ GeneratorCV::~GeneratorCV()
     pipelines.clear();
 
     delete outputPipeline;
+
+    for (auto operation: defaultImageOperations)
+        delete operation;
 }
 
 void GeneratorCV::destroyAllWindows()
@@ -374,15 +744,58 @@ void GeneratorCV::destroyAllWindows()
 
 void GeneratorCV::setMask()
 {
-    mask = cv::Mat::zeros(imageSize, imageSize, CV_8U);
+    mask = cv::Mat::zeros(imageHeight, imageWidth, CV_8U);
 
     if (circularMask)
     {
-        cv::Point center = cv::Point(imageSize / 2, imageSize / 2);
-        cv::circle(mask, center, imageSize / 2 - 2, cv::Scalar(255, 255, 255), -1, cv::FILLED);
+        cv::Point center = cv::Point(imageWidth / 2, imageHeight / 2);
+        cv::circle(mask, center, std::min(imageWidth, imageHeight) / 2 - 2, cv::Scalar(255, 255, 255), -1, cv::FILLED);
     }
     else
-        cv::rectangle(mask, cv::Point(0, 0), cv::Point(imageSize, imageSize), cv::Scalar(255, 255, 255), -1);
+        cv::rectangle(mask, cv::Point(0, 0), cv::Point(imageWidth, imageHeight), cv::Scalar(255, 255, 255), -1);
+
+    // Both masks are convex: a single [start, end) span per row describes them
+
+    maskSpans.assign(imageHeight, cv::Range(0, 0));
+    maskFull = true;
+
+    for (int row = 0; row < imageHeight; row++)
+    {
+        const uchar *m = mask.ptr<uchar>(row);
+
+        int start = 0;
+        while (start < imageWidth && !m[start])
+            start++;
+
+        int end = imageWidth;
+        while (end > start && !m[end - 1])
+            end--;
+
+        if (start < end)
+            maskSpans[row] = cv::Range(start, end);
+
+        if (start != 0 || end != imageWidth)
+            maskFull = false;
+    }
+}
+
+void GeneratorCV::applyMask(cv::Mat &image)
+{
+    // Zero the exterior of the mask in place, nothing to do for the full mask
+
+    if (maskFull)
+        return;
+
+    for (int row = 0; row < image.rows; row++)
+    {
+        cv::Mat imageRow = image.row(row);
+        const cv::Range &span = maskSpans[row];
+
+        // Rows outside the mask have an empty span at 0, so the second range covers them
+
+        imageRow.colRange(0, span.start).setTo(cv::Scalar::all(0));
+        imageRow.colRange(span.end, image.cols).setTo(cv::Scalar::all(0));
+    }
 }
 
 void GeneratorCV::toggleMask(bool apply)
@@ -394,16 +807,15 @@ void GeneratorCV::toggleMask(bool apply)
 
 void GeneratorCV::computeHistogramMax()
 {
-    cv::Mat full = cv::Mat::ones(imageSize, imageSize, CV_8U);
-    cv::Mat masked;
-    full.copyTo(masked, mask);
-    int pixelCount = cv::countNonZero(masked);
+    int pixelCount = 0;
+    for (const cv::Range &span: maskSpans)
+        pixelCount += span.size();
     histogramMax = pixelCount * 5.0 / 100.0;
 }
 
 void GeneratorCV::drawRandomSeed(bool grayscale)
 {
-    cv::Mat randomSeedImage = cv::Mat(imageSize, imageSize, CV_8UC3);
+    cv::Mat randomSeedImage = cv::Mat(imageHeight, imageWidth, CV_8UC3);
     cv::randu(randomSeedImage, cv::Scalar::all(0), cv::Scalar::all(255));
 
     if (grayscale)
@@ -412,27 +824,25 @@ void GeneratorCV::drawRandomSeed(bool grayscale)
         cv::cvtColor(randomSeedImage, randomSeedImage, cv::COLOR_GRAY2BGR);
     }
 
-    cv::Mat maskedSeed = cv::Mat::zeros(imageSize, imageSize, CV_8UC3);
-    randomSeedImage.copyTo(maskedSeed, mask);
+    applyMask(randomSeedImage);
 
     for (auto pipeline: pipelines)
-        pipeline->image = maskedSeed.clone();
+        pipeline->image = randomSeedImage.clone();
 
-    outputImage = maskedSeed.clone();
+    outputImage = randomSeedImage.clone();
+    outputImageShared = false;
 
-    cv::imshow("Frame", maskedSeed);
+    cv::imshow("Frame", randomSeedImage);
 }
 
 void GeneratorCV::loadSeedImage(std::string filename)
 {
     seedImage = cv::imread(filename);
 
-    if (seedImage.size() != cv::Size(imageSize, imageSize))
-        cv::resize(seedImage, seedImage, cv::Size(imageSize, imageSize));
+    if (seedImage.size() != cv::Size(imageWidth, imageHeight))
+        cv::resize(seedImage, seedImage, cv::Size(imageWidth, imageHeight));
 
-    cv::Mat maskedSeed = cv::Mat::zeros(imageSize, imageSize, CV_8UC3);
-    seedImage.copyTo(maskedSeed, mask);
-    seedImage = maskedSeed.clone();
+    applyMask(seedImage);
 }
 
 void GeneratorCV::drawSeedImage()
@@ -443,6 +853,7 @@ void GeneratorCV::drawSeedImage()
             pipeline->image = seedImage.clone();
 
         outputImage = seedImage.clone();
+        outputImageShared = false;
 
         cv::imshow("Frame", seedImage);
     }
@@ -455,27 +866,34 @@ void GeneratorCV::setPlainColor(int blue, int green, int red)
 
 void GeneratorCV::drawPlainColorSeed()
 {
-    cv::Mat plainColorSeed(imageSize, imageSize, CV_8UC3, plainColor);
+    cv::Mat plainColorSeed(imageHeight, imageWidth, CV_8UC3, plainColor);
 
-    cv::Mat maskedSeed = cv::Mat::zeros(imageSize, imageSize, CV_8UC3);
-    plainColorSeed.copyTo(maskedSeed, mask);
+    applyMask(plainColorSeed);
 
     for (auto pipeline: pipelines)
-        pipeline->image = maskedSeed.clone();
+        pipeline->image = plainColorSeed.clone();
 
-    outputImage = maskedSeed.clone();
+    outputImage = plainColorSeed.clone();
+    outputImageShared = false;
 
-    cv::imshow("Frame", maskedSeed);
+    cv::imshow("Frame", plainColorSeed);
 }
 
 void GeneratorCV::blendImages()
 {
-    cv::Mat blendImage = cv::Mat::zeros(imageSize, imageSize, CV_8UC3);
+    // Accumulated band by band in parallel, so each band of the blend stays in cache across pipelines
 
-    for (auto pipeline: pipelines)
-        cv::addWeighted(blendImage, 1.0, pipeline->image, pipeline->blendFactor, 0.0, blendImage);
+    cv::Mat blendImage = cv::Mat::zeros(imageHeight, imageWidth, CV_8UC3);
+
+    cv::parallel_for_(cv::Range(0, imageHeight), [&](const cv::Range &range)
+    {
+        cv::Mat band = blendImage.rowRange(range.start, range.end);
 
-    outputPipeline->image = blendImage.clone();
+        for (auto pipeline: pipelines)
+            cv::addWeighted(band, 1.0, pipeline->image.rowRange(range.start, range.end), pipeline->blendFactor, 0.0, band);
+    });
+
+    outputPipeline->image = blendImage;
 }
 
 void GeneratorCV::iterate()
@@ -490,9 +908,11 @@ void GeneratorCV::iterate()
 
     outputPipeline->iterate();
 
-    outputImage = cv::Mat::zeros(imageSize, imageSize, CV_8UC3);
+    // The output pipeline image is a fresh frame every iteration, so it is masked in place and shared
 
-    outputPipeline->image.copyTo(outputImage, mask);
+    applyMask(outputPipeline->image);
+    outputImage = outputPipeline->image;
+    outputImageShared = false;
 
     if (pointerCanvasDrawn)
         drawPointerCanvas();
@@ -503,84 +923,90 @@ void GeneratorCV::iterate()
     iteration++;
 }
 
-void GeneratorCV::computeBGRSum()
+void GeneratorCV::requestAnalysis(bool statistics, int xChannel, int yChannel, bool spectrum, bool patternScale, bool pixel)
 {
-    bgrSum = cv::sum(outputImage);
+    // The output frame is never modified in place once computed, so it is shared with the worker without a copy
+
+    AnalysisWorker::Request request;
+
+    request.image = outputImage;
+    outputImageShared = true;
+    request.mask = mask;
+    request.iteration = iteration;
+    request.statistics = statistics;
+    request.densityX = xChannel;
+    request.densityY = yChannel;
+    request.spectrum = spectrum;
+    request.patternScale = patternScale;
+    request.pixel = pixel;
+    request.pixelPosition = selectedPixel;
+
+    analysisWorker.submit(request);
 }
 
-void GeneratorCV::computeBGRPixel()
+bool GeneratorCV::collectAnalysis()
 {
-    bgrPixel = outputImage.at<cv::Vec3b>(selectedPixel);
+    return analysisWorker.takeResult(analysis);
 }
 
-void GeneratorCV::computeHistogram()
+void GeneratorCV::showSpectrum()
 {
-    float range[] = {0, 256};
-    const float *histogramRange[] = {range};
-
-    cv::Mat bgrChannels[3];
-    cv::split(outputImage, bgrChannels);
-
-    cv::calcHist(&bgrChannels[0], 1, 0, mask, blueHistogram, 1, &histogramSize, histogramRange, true, false);
-    cv::calcHist(&bgrChannels[1], 1, 0, mask, greenHistogram, 1, &histogramSize, histogramRange, true, false);
-    cv::calcHist(&bgrChannels[2], 1, 0, mask, redHistogram, 1, &histogramSize, histogramRange, true, false);
+    if (analysis.spectrum)
+        cv::imshow("DFT Spectrum Magnitude", analysis.spectrumImage);
 }
 
-void GeneratorCV::computeDFT()
+void GeneratorCV::showPixelSelectionCursor()
 {
-    cv::Mat outputImageGray;
-    cv::cvtColor(outputImage, outputImageGray, cv::COLOR_BGR2GRAY);
-
-    cv::Mat padded;
-    int m = cv::getOptimalDFTSize(outputImage.rows);
-    int n = cv::getOptimalDFTSize(outputImage.cols);
-    cv::copyMakeBorder(outputImageGray, padded, 0, m - outputImageGray.rows, 0, n - outputImageGray.cols, cv::BORDER_CONSTANT, cv::Scalar::all(0));
-
-    cv::Mat planes[] = {cv::Mat_<float>(padded), cv::Mat::zeros(padded.size(), CV_32F)};
-    cv::Mat complexOutImage;
-    cv::merge(planes, 2, complexOutImage);
+    // A frame shared with the analysis worker must not be modified, so the cursor is blended over a copy
+    // Otherwise only the cursor row and column are blended in place, and copied back once shown
 
-    cv::dft(complexOutImage, complexOutImage);
+    bool rowVisible = selectedPixel.y >= 0 && selectedPixel.y < imageHeight;
+    bool columnVisible = selectedPixel.x >= 0 && selectedPixel.x < imageWidth;
 
-    cv::split(complexOutImage, planes);
-    cv::magnitude(planes[0], planes[1], planes[0]);
-    cv::Mat magOutImage = planes[0];
+    cv::Mat image = outputImage;
 
-    magOutImage += cv::Scalar::all(1);
-    cv::log(magOutImage, magOutImage);
-
-    magOutImage = magOutImage(cv::Rect(0, 0, magOutImage.cols & -2, magOutImage.rows & -2));
+    if (outputImageShared)
+    {
+        outputImage.copyTo(cursorImage);
+        image = cursorImage;
+    }
 
-    int cx = magOutImage.cols / 2;
-    int cy = magOutImage.rows / 2;
+    // Both are saved before blending, so that the pixel where they cross is blended once
 
-    cv::Mat q0(magOutImage, cv::Rect(0, 0, cx, cy));
-    cv::Mat q1(magOutImage, cv::Rect(cx, 0, cx, cy));
-    cv::Mat q2(magOutImage, cv::Rect(0 ,cy, cx, cy));
-    cv::Mat q3(magOutImage, cv::Rect(cx, cy, cx, cy));
+    if (rowVisible)
+        outputImage.row(selectedPixel.y).copyTo(cursorRow);
 
-    cv::Mat tmp;
+    if (columnVisible)
+        outputImage.col(selectedPixel.x).copyTo(cursorColumn);
 
-    q0.copyTo(tmp);
-    q3.copyTo(q0);
-    tmp.copyTo(q3);
+    if (rowVisible)
+    {
+        cv::Mat row = image.row(selectedPixel.y);
+        cursorRow.convertTo(row, -1, 0.5, 127.5);
+    }
 
-    q1.copyTo(tmp);
-    q2.copyTo(q1);
-    tmp.copyTo(q2);
+    if (columnVisible)
+    {
+        cv::Mat column = image.col(selectedPixel.x);
+        cursorColumn.convertTo(column, -1, 0.5, 127.5);
+    }
 
-    cv::normalize(magOutImage, magOutImage, 0, 1, cv::NORM_MINMAX);
+    cv::imshow("Frame", image);
 
-    cv::imshow("DFT Spectrum Magnitude", magOutImage);
-}
+    if (!outputImageShared)
+    {
+        if (rowVisible)
+        {
+            cv::Mat row = outputImage.row(selectedPixel.y);
+            cursorRow.copyTo(row);
+        }
 
-void GeneratorCV::showPixelSelectionCursor()
-{
-    cv::Mat layer = cv::Mat::zeros(imageSize, imageSize, CV_8UC3);
-    cv::line(layer, cv::Point(0, selectedPixel.y), cv::Point(imageSize, selectedPixel.y), cv::Scalar(255, 255, 255));
-    cv::line(layer, cv::Point(selectedPixel.x, 0), cv::Point(selectedPixel.x, imageSize), cv::Scalar(255, 255, 255));
-    cv::addWeighted(outputImage, 0.5, layer, 0.5, 0.0, layer);
-    cv::imshow("Frame", layer);
+        if (columnVisible)
+        {
+            cv::Mat column = outputImage.col(selectedPixel.x);
+            cursorColumn.copyTo(column);
+        }
+    }
 }
 
 void GeneratorCV::showImage()
@@ -590,7 +1016,7 @@ void GeneratorCV::showImage()
 
 void GeneratorCV::openVideoWriter(std::string name)
 {
-    videoWriter.open(name, cv::VideoWriter::fourcc('P', 'I', 'M', '1'), framesPerSecond, cv::Size(imageSize, imageSize), true);
+    videoWriter.open(name, cv::VideoWriter::fourcc('P', 'I', 'M', '1'), framesPerSecond, cv::Size(imageWidth, imageHeight), true);
     frameCount = 0;
 }
 
@@ -634,71 +1060,106 @@ void GeneratorCV::processMouse(int event, int x, int y, int flags)
 void GeneratorCV::drawPointer(int x, int y)
 {
     if (!persistentDrawing)
-        pointerCanvas = cv::Mat::zeros(imageSize, imageSize, CV_8UC3);
+        clearPointerCanvas();
 
     cv::circle(pointerCanvas, cv::Point(x, y), pointerRadius, pointerColor, pointerThickness, cv::FILLED);
 
-    cv::Mat dst = cv::Mat::zeros(imageSize, imageSize, CV_8UC3);
-    pointerCanvas.copyTo(dst, mask);
-    pointerCanvas = dst.clone();
+    int extent = pointerRadius + std::max(pointerThickness, 1);
+    cv::Rect circleRect = cv::Rect(x - extent, y - extent, 2 * extent + 1, 2 * extent + 1) & cv::Rect(0, 0, imageWidth, imageHeight);
+
+    updatePointerMask(circleRect);
 
+    pointerCanvasRect |= circleRect;
     pointerCanvasDrawn = true;
 
+    // Into a copy of the frame: the current one may be under analysis
+
+    outputImage = outputImage.clone();
+    outputImageShared = false;
+
     drawPointerCanvas();
     cv::imshow("Frame", outputImage);
 }
 
 void GeneratorCV::drawCenteredPointer()
 {
-    drawPointer(imageSize / 2, imageSize / 2);
+    drawPointer(imageWidth / 2, imageHeight / 2);
 }
 
-void GeneratorCV::drawPointerCanvas()
+void GeneratorCV::updatePointerMask(cv::Rect rect)
 {
+    if (rect.empty())
+        return;
+
+    // Drawn pixels are those of the canvas brighter than 1 and within the mask
+
     cv::Mat pointerCanvasGray;
-    cv::cvtColor(pointerCanvas, pointerCanvasGray, cv::COLOR_BGR2GRAY);
-    cv::Mat drawingMask;
-    cv::threshold(pointerCanvasGray, drawingMask, 1, 255, cv::THRESH_BINARY);
-    cv::Mat maskInverse;
-    cv::bitwise_not(drawingMask, maskInverse);
+    cv::cvtColor(pointerCanvas(rect), pointerCanvasGray, cv::COLOR_BGR2GRAY);
 
-    cv::Mat outputImageMasked;
-    cv::bitwise_and(outputImage, outputImage, outputImageMasked, maskInverse);
-    cv::Mat pointerCanvasMasked;
-    cv::bitwise_and(pointerCanvas, pointerCanvas, pointerCanvasMasked, drawingMask);
+    cv::Mat pointerMaskROI = pointerMask(rect);
+    cv::threshold(pointerCanvasGray, pointerMaskROI, 1, 255, cv::THRESH_BINARY);
+    cv::bitwise_and(pointerMaskROI, mask(rect), pointerMaskROI);
+}
 
-    cv::add(outputImageMasked, pointerCanvasMasked, outputImage);
+void GeneratorCV::drawPointerCanvas()
+{
+    // Composite only the rectangle touched by the pointer since the canvas was cleared
+    // The output frame must not be shared yet
+
+    if (pointerCanvasRect.empty())
+        return;
+
+    cv::Mat outputImageROI = outputImage(pointerCanvasRect);
+    pointerCanvas(pointerCanvasRect).copyTo(outputImageROI, pointerMask(pointerCanvasRect));
 }
 
 void GeneratorCV::clearPointerCanvas()
 {
-    pointerCanvas = cv::Mat::zeros(imageSize, imageSize, CV_8UC3);
+    if (pointerCanvas.size() != cv::Size(imageWidth, imageHeight))
+    {
+        pointerCanvas = cv::Mat::zeros(imageHeight, imageWidth, CV_8UC3);
+        pointerMask = cv::Mat::zeros(imageHeight, imageWidth, CV_8UC1);
+    }
+    else if (!pointerCanvasRect.empty())
+    {
+        pointerCanvas(pointerCanvasRect).setTo(cv::Scalar::all(0));
+        pointerMask(pointerCanvasRect).setTo(cv::Scalar::all(0));
+    }
 
+    pointerCanvasRect = cv::Rect();
     pointerCanvasDrawn = false;
 }
 
-void GeneratorCV::setImageSize(int size)
+void GeneratorCV::setImageSize(int width, int height)
 {
-    imageSize = size;
+    imageWidth = width;
+    imageHeight = height;
 
-    colorScaleFactor = 1.0 / (imageSize * imageSize * 255);
+    colorScaleFactor = 1.0 / (imageWidth * imageHeight * 255);
 
     for (auto &pipeline: pipelines)
-        cv::resize(pipeline->image, pipeline->image, cv::Size(imageSize, imageSize));
+        cv::resize(pipeline->image, pipeline->image, cv::Size(imageWidth, imageHeight));
 
-    cv::resize(outputImage, outputImage, cv::Size(imageSize, imageSize));
+    cv::Mat resizedImage;
+    cv::resize(outputImage, resizedImage, cv::Size(imageWidth, imageHeight));
+    outputImage = resizedImage;
+    outputImageShared = false;
 
     if (!seedImage.empty())
-        cv::resize(seedImage, seedImage, cv::Size(imageSize, imageSize));
+        cv::resize(seedImage, seedImage, cv::Size(imageWidth, imageHeight));
 
-    cv::resize(pointerCanvas, pointerCanvas, cv::Size(imageSize, imageSize));
+    cv::resize(pointerCanvas, pointerCanvas, cv::Size(imageWidth, imageHeight));
+    pointerMask = cv::Mat::zeros(imageHeight, imageWidth, CV_8UC1);
 
     setMask();
     computeHistogramMax();
 
+    pointerCanvasRect = pointerCanvasDrawn ? cv::Rect(0, 0, imageWidth, imageHeight) : cv::Rect();
+    updatePointerMask(pointerCanvasRect);
+
     cv::imshow("Frame", outputImage);
 
-    selectedPixel = cv::Point(imageSize / 2, imageSize / 2);
+    selectedPixel = cv::Point(imageWidth / 2, imageHeight / 2);
 }
 
 QVector<double> GeneratorCV::getBlueHistogram()
@@ -706,7 +1167,7 @@ QVector<double> GeneratorCV::getBlueHistogram()
     QVector<double> histogram(histogramSize);
 
     for (int i = 0; i < histogramSize; i++)
-        histogram[i] = blueHistogram.at<float>(i);
+        histogram[i] = analysis.frameStatistics.histograms.at<int>(0, i);
 
     return histogram;
 }
@@ -716,7 +1177,7 @@ QVector<double> GeneratorCV::getGreenHistogram()
     QVector<double> histogram(histogramSize);
 
     for (int i = 0; i < histogramSize; i++)
-        histogram[i] = greenHistogram.at<float>(i);
+        histogram[i] = analysis.frameStatistics.histograms.at<int>(1, i);
 
     return histogram;
 }
@@ -726,7 +1187,7 @@ QVector<double> GeneratorCV::getRedHistogram()
     QVector<double> histogram(histogramSize);
 
     for (int i = 0; i < histogramSize; i++)
-        histogram[i] = redHistogram.at<float>(i);
+        histogram[i] = analysis.frameStatistics.histograms.at<int>(2, i);
 
     return histogram;
 }
@@ -741,15 +1202,22 @@ QVector<double> GeneratorCV::getHistogramBins()
     return bins;
 }
 
-QVector<double> GeneratorCV::getColorComponents(int colorIndex)
+QVector<double> GeneratorCV::getColorDensity()
 {
-    QVector<double> components;
+    // Density of the last analysis, rows indexing y values
+
+    QVector<double> density;
+
+    if (analysis.frameStatistics.density.empty())
+        return density;
+
+    density.resize(256 * 256);
 
-    cv::MatIterator_<cv::Vec3b> it, end;
-    for (it = outputImage.begin<cv::Vec3b>(), end = outputImage.end<cv::Vec3b>(); it != end; ++it)
-        components.push_back((*it)[colorIndex]);
+    const int *count = analysis.frameStatistics.density.ptr<int>();
+    for (int i = 0; i < 256 * 256; i++)
+        density[i] = count[i];
 
-    return components;
+    return density;
 }
 
 void GeneratorCV::swapImageOperations(int pipelineIndex, int operationIndex0, int operationIndex1)
@@ -776,6 +1244,21 @@ void GeneratorCV::insertImageOperation(int pipelineIndex, int newOperationIndex,
         outputPipeline->insertImageOperation(newOperationIndex, currentOperationIndex);
 }
 
+double GeneratorCV::estimateOperationCost(int newOperationIndex)
+{
+    // Estimated for the operation's default parameters, before inserting it
+
+    if (newOperationIndex < 0 || newOperationIndex >= static_cast<int>(defaultImageOperations.size()))
+        return 0.0;
+
+    ImageOperation *operation = defaultImageOperations[newOperationIndex];
+
+    if (!operation)
+        return 0.0;
+
+    return Pipeline::costModel.estimate(operation, cv::Size(imageWidth, imageHeight));
+}
+
 void GeneratorCV::removePipeline(int pipelineIndex)
 {
     if (pipelineIndex >= 0 && !pipelines.empty())
@@ -804,7 +1287,7 @@ void GeneratorCV::removePipeline(int pipelineIndex)
 
 void GeneratorCV::addPipeline()
 {
-    pipelines.push_back(new Pipeline(outputImage));
+    pipelines.push_back(new Pipeline(outputImage.clone()));
     if (pipelines.size() == 1)
         pipelines.back()->blendFactor = 1.0;
     else
@@ -813,8 +1296,8 @@ void GeneratorCV::addPipeline()
 
 void GeneratorCV::loadPipeline(double blendFactor)
 {
-    cv::Mat mat;
-    outputImage.copyTo(mat, mask);
+    cv::Mat mat = outputImage.clone();
+    applyMask(mat);
     pipelines.push_back(new Pipeline(mat));
     pipelines.back()->blendFactor = blendFactor;
 }
@@ -19,8 +19,11 @@
 #define GENERATOR_H
 
 #include "imageoperations.h"
+#include "statistics.h"
 #include <vector>
 #include <string>
+#include <map>
+#include <algorithm>
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
@@ -28,19 +31,43 @@
 #include <opencv2/videoio.hpp>
 #include <QVector>
 
+// Operation cost model
+// Estimated time of an operation: coefficient of its type * megapixels * its cost factor
+// Coefficients start from a rough guess and are calibrated from the pipelines' own timings: the measured time of a
+// run of operations is compared with its estimate, and the coefficients involved move part of the way towards it
+
+class OperationCostModel
+{
+    std::map<std::string, double> coefficients;
+
+    double getCoefficient(const std::string &name);
+
+public:
+    double estimate(ImageOperation *operation, cv::Size size);
+    double estimate(const std::vector<ImageOperation*> &operations, cv::Size size);
+    void calibrate(const std::vector<ImageOperation*> &operations, cv::Size size, double milliseconds);
+};
+
 class Pipeline
 {
     std::vector<std::string> availableImageOperations;
 
+    std::vector<FusedLinearFilter*> fusedOperations;
+    std::vector<FusedColorMatrix*> fusedColorOperations;
+
 public:
     cv::Mat image;
     std::vector<ImageOperation*> imageOperations;
 
     double blendFactor;
 
+    static OperationCostModel costModel;
+
     Pipeline(cv::Mat img);
     ~Pipeline();
 
+    static ImageOperation* newImageOperation(std::string operationName);
+
     void iterate();
 
     void swapImageOperations(int operationIndex0, int operationIndex1);
@@ -61,31 +88,39 @@ public:
 class GeneratorCV
 {
     cv::Mat mask;
+    std::vector<cv::Range> maskSpans;
+    bool maskFull;
     cv::Mat seedImage;
     cv::Mat outputImage;
+    bool outputImageShared;
 
     int iteration;
 
-    int imageSize;
+    std::vector<ImageOperation*> defaultImageOperations;
+
+    int imageWidth;
+    int imageHeight;
 
     bool circularMask;
 
     cv::Scalar plainColor;
 
     int histogramSize;
-    cv::Mat blueHistogram;
-    cv::Mat greenHistogram;
-    cv::Mat redHistogram;
 
     double histogramMax;
     double colorScaleFactor;
 
-    cv::Scalar bgrSum;
-    cv::Vec3b bgrPixel;
+    AnalysisWorker analysisWorker;
+    AnalysisWorker::Result analysis;
 
     cv::Point selectedPixel;
+    cv::Mat cursorImage;
+    cv::Mat cursorRow;
+    cv::Mat cursorColumn;
 
     cv::Mat pointerCanvas;
+    cv::Mat pointerMask;
+    cv::Rect pointerCanvasRect;
     bool pointerCanvasDrawn;
     cv::Point pointer;
     int pointerRadius;
@@ -97,12 +132,14 @@ class GeneratorCV
     cv::VideoWriter videoWriter;
 
     void setMask();
+    void applyMask(cv::Mat &image);
     void computeHistogramMax();
     void applyImageOperations();
     void blendImages();
     static void onMouse(int event, int x, int y, int flags, void* userdata);
     void processMouse(int event, int x, int y, int flags);
     void drawPointer(int x, int y);
+    void updatePointerMask(cv::Rect rect);
     void drawPointerCanvas();
 
 public:
@@ -132,16 +169,18 @@ public:
 
     void toggleMask(bool apply);
 
-    void computeBGRSum();
-    void computeBGRPixel();
-    void computeHistogram();
-    void computeDFT();
+    // Analysis of the current output frame, computed in the background: results arrive some iterations later
+
+    void requestAnalysis(bool statistics, int xChannel, int yChannel, bool spectrum, bool patternScale, bool pixel);
+    bool collectAnalysis();
+    const AnalysisWorker::Result& getAnalysis(){ return analysis; }
+    void showSpectrum();
     void showPixelSelectionCursor();
     void showImage();
 
     void clearPointerCanvas();
     void drawCenteredPointer();
-    void setPointerRadius(int radius){ if (radius > 0 && radius < imageSize / 2) pointerRadius = radius;}
+    void setPointerRadius(int radius){ if (radius > 0 && radius < std::min(imageWidth, imageHeight) / 2) pointerRadius = radius;}
     int getPointerRadius(){ return pointerRadius; }
     void setPointerThickness(int thickness){ if (thickness >= -1) pointerThickness = thickness; }
     int getPointerThickness(){ return pointerThickness; }
@@ -161,26 +200,29 @@ public:
 
     int getHistogramMax(){ return histogramMax; }
 
-    void setImageSize(int size);
-    int getImageSize(){ return imageSize; }
+    void setImageSize(int width, int height);
+    int getImageWidth(){ return imageWidth; }
+    int getImageHeight(){ return imageHeight; }
 
-    double getBSum(){ return bgrSum[0] * colorScaleFactor; }
-    double getGSum(){ return bgrSum[1] * colorScaleFactor; }
-    double getRSum(){ return bgrSum[2] * colorScaleFactor; }
+    double getBSum(){ return analysis.frameStatistics.bgrSum[0] * colorScaleFactor; }
+    double getGSum(){ return analysis.frameStatistics.bgrSum[1] * colorScaleFactor; }
+    double getRSum(){ return analysis.frameStatistics.bgrSum[2] * colorScaleFactor; }
 
-    double getPixelComponent(int colorIndex){ return bgrPixel[colorIndex]; }
+    double getPixelComponent(int colorIndex){ return analysis.pixelValue[colorIndex]; }
 
     QVector<double> getBlueHistogram();
     QVector<double> getGreenHistogram();
     QVector<double> getRedHistogram();
     QVector<double> getHistogramBins();
 
-    QVector<double> getColorComponents(int colorIndex);
+    QVector<double> getColorDensity();
 
     void swapImageOperations(int pipelineIndex, int operationIndex0, int operationIndex1);
     void removeImageOperation(int pipelineIndex, int operationIndex);
     void insertImageOperation(int pipelineIndex, int newOperationIndex, int currentOperationIndex);
 
+    double estimateOperationCost(int newOperationIndex);
+
     std::string getImageOperationName(int pipelineIndex, int operationIndex)
     {
         if (pipelineIndex >= 0)
@@ -17,11 +17,28 @@
 
 #include "imageoperations.h"
 
+// Color space conversion, through BGR when neither end is BGR
+
+void convertColorSpace(cv::Mat &image, FrameColorSpace from, FrameColorSpace to)
+{
+    if (from == to)
+        return;
+
+    static const int toBGR[] = {-1, cv::COLOR_HSV2BGR, cv::COLOR_HLS2BGR, cv::COLOR_YCrCb2BGR};
+    static const int fromBGR[] = {-1, cv::COLOR_BGR2HSV, cv::COLOR_BGR2HLS, cv::COLOR_BGR2YCrCb};
+
+    if (from != COLOR_SPACE_BGR)
+        cv::cvtColor(image, image, toBGR[from]);
+
+    if (to != COLOR_SPACE_BGR)
+        cv::cvtColor(image, image, fromBGR[to]);
+}
+
 // Bilateral filter
 
 std::string BilateralFilter::name = "Blur: bilateral";
 
-BilateralFilter::BilateralFilter(bool on, int d, double sc, double ss): ImageOperation(on)
+BilateralFilter::BilateralFilter(bool on, int d, double sc, double ss, int e): ImageOperation(on)
 {
     diameter = new IntParameter("Diameter", d, 0, 50, false);
 
@@ -32,13 +49,50 @@ BilateralFilter::BilateralFilter(bool on, int d, double sc, double ss): ImageOpe
     double minSigmaSpace, maxSigmaSpace;
     adjustMinMax(ss, 0.0, 300.0, minSigmaSpace, maxSigmaSpace);
     sigmaSpace = new DoubleParameter("Sigma space", ss, minSigmaSpace, maxSigmaSpace, 0.0, 1.0e6);
+
+    // The domain transform ignores the diameter: its cost does not depend on the spatial extent
+
+    std::vector<std::string> names = {"Exact", "Domain transform"};
+    std::vector<int> values = {0, 1};
+
+    engine = new OptionsParameter<int>("Engine", names, values, e);
+}
+
+int BilateralFilter::getHalo()
+{
+    // cv::bilateralFilter derives its radius from sigmaSpace when the diameter is not positive
+    // The domain transform is recursive: every pixel depends on its whole row and column
+
+    if (engine->value == 1)
+        return -1;
+
+    double sigma = sigmaSpace->value > 0.0 ? sigmaSpace->value : 1.0;
+    int radius = diameter->value > 0 ? diameter->value / 2 : cvRound(sigma * 1.5);
+
+    return std::max(radius, 1);
+}
+
+double BilateralFilter::getCostFactor()
+{
+    // Direct filter: one weight per pixel of the window; domain transform: fixed number of passes
+
+    if (engine->value == 1)
+        return 1.0;
+
+    int radius = getHalo();
+    return (2 * radius + 1) * (2 * radius + 1);
 }
 
 void BilateralFilter::applyOperation(cv::Mat &src)
 {
-    cv::Mat dst(src.rows, src.cols, src.type());
-    cv::bilateralFilter(src, dst, diameter->value, sigmaColor->value, sigmaSpace->value, cv::BORDER_ISOLATED);
-    src = dst.clone();
+    cv::Mat dst;
+
+    if (engine->value == 1)
+        domainTransformFilter(src, dst, sigmaSpace->value, sigmaColor->value);
+    else
+        cv::bilateralFilter(src, dst, diameter->value, sigmaColor->value, sigmaSpace->value, cv::BORDER_ISOLATED);
+
+    src = dst;
 }
 
 // Blend previous images
@@ -88,6 +142,13 @@ Blur::Blur(bool on, int size): ImageOperation(on)
     ksize = new IntParameter("Kernel size", size, 1, 51, true);
 }
 
+bool Blur::getLinearKernel(cv::Mat &kernel, bool &absolute)
+{
+    kernel = cv::Mat(ksize->value, ksize->value, CV_32F, cv::Scalar::all(1.0 / (ksize->value * ksize->value)));
+    absolute = false;
+    return true;
+}
+
 void Blur::applyOperation(cv::Mat &src)
 {
     cv::blur(src, src, cv::Size(ksize->value, ksize->value), cv::Point(-1, -1), cv::BORDER_ISOLATED);
@@ -139,31 +200,48 @@ ColorQuantization::ColorQuantization(bool on, int nBGRLevels, int nHueLevels, in
 
 void ColorQuantization::applyOperation(cv::Mat &src)
 {
-    if (colorSpace->value == 0)
-    {
-        src.forEach<cv::Vec3b>([&](cv::Vec3b &pixel, const int*)
-        {
-            pixel[0] = static_cast<uchar>(roundf(pixel[0] * bgrLevels->value / 255.0) * 255.0 / bgrLevels->value);
-            pixel[1] = static_cast<uchar>(roundf(pixel[1] * bgrLevels->value / 255.0) * 255.0 / bgrLevels->value);
-            pixel[2] = static_cast<uchar>(roundf(pixel[2] * bgrLevels->value / 255.0) * 255.0 / bgrLevels->value);
-        });
-    }
-    else if (colorSpace->value == 1)
+    FrameColorSpace space = getColorSpace();
+
+    convertColorSpace(src, COLOR_SPACE_BGR, space);
+    applyOperationInColorSpace(src);
+    convertColorSpace(src, space, COLOR_SPACE_BGR);
+}
+
+void ColorQuantization::computeLookUpTable()
+{
+    std::vector<int> key = {colorSpace->value, bgrLevels->value, hueLevels->value, lightLevels->value, satLevels->value};
+
+    if (key == tableKey && !lookUpTable.empty())
+        return;
+
+    tableKey = key;
+
+    // Same expression as the per pixel quantization, evaluated once per channel value
+
+    auto quantize = [](int value, int levels, double maxValue)
     {
-        cv::Mat hls;
-        cv::cvtColor(src, hls, cv::COLOR_BGR2HLS);
+        return static_cast<uchar>(roundf(value * levels / maxValue) * maxValue / levels);
+    };
 
-        hls.forEach<cv::Vec3b>([&](cv::Vec3b &pixel, const int*)
-        {
-            pixel[0] = static_cast<uchar>(roundf(pixel[0] * hueLevels->value / 179.0) * 179.0 / hueLevels->value);
-            pixel[1] = static_cast<uchar>(roundf(pixel[1] * lightLevels->value / 255.0) * 255.0 / lightLevels->value);
-            pixel[2] = static_cast<uchar>(roundf(pixel[2] * satLevels->value / 255.0) * 255.0 / satLevels->value);
-        });
+    lookUpTable = cv::Mat(1, 256, CV_8UC3);
+    cv::Vec3b *lut = lookUpTable.ptr<cv::Vec3b>();
 
-        cv::cvtColor(hls, src, cv::COLOR_HLS2BGR);
+    for (int i = 0; i < 256; i++)
+    {
+        if (colorSpace->value == 1)
+            lut[i] = cv::Vec3b(quantize(i, hueLevels->value, 179.0), quantize(i, lightLevels->value, 255.0), quantize(i, satLevels->value, 255.0));
+        else
+            lut[i] = cv::Vec3b::all(quantize(i, bgrLevels->value, 255.0));
     }
 }
 
+void ColorQuantization::applyOperationInColorSpace(cv::Mat &src)
+{
+    // Table built by prepareFrame
+
+    cv::LUT(src, lookUpTable, src);
+}
+
 // Convert to
 
 std::string ConvertTo::name = "Contrast/brightness";
@@ -179,11 +257,30 @@ ConvertTo::ConvertTo(bool on, double a, double b): ImageOperation(on)
     beta = new DoubleParameter("Bias", b, minBeta, maxBeta, -1.0e6, 1.0e6);
 }
 
+bool ConvertTo::getColorMatrix(cv::Mat &matrix)
+{
+    matrix = cv::Mat::zeros(3, 4, CV_64F);
+
+    for (int i = 0; i < 3; i++)
+    {
+        matrix.at<double>(i, i) = alpha->value;
+        matrix.at<double>(i, 3) = beta->value;
+    }
+
+    return true;
+}
+
 void ConvertTo::applyOperation(cv::Mat &src)
 {
     src.convertTo(src, -1, alpha->value, beta->value);
 }
 
+void ConvertTo::applyOperationPlanar(std::vector<cv::Mat> &planes)
+{
+    for (auto &plane: planes)
+        plane.convertTo(plane, -1, alpha->value, beta->value);
+}
+
 // Deblur filter
 
 std::string DeblurFilter::name = "Deblur filter";
@@ -280,6 +377,37 @@ void DeblurFilter::applyOperation(cv::Mat &src)
     cv::normalize(dst, src, 0, 255, cv::NORM_MINMAX);
 }
 
+void DeblurFilter::applyOperationPlanar(std::vector<cv::Mat> &planes)
+{
+    cv::Rect roi = cv::Rect(0, 0, planes[0].cols & -2, planes[0].rows & -2);
+
+    cv::Mat Hw, h;
+    computePSF(h, roi.size());
+    computeWnrFilter(h, Hw, 1.0 / signalToNoiseRatio->value);
+
+    // Min-max normalization over all channels at once, as cv::normalize does on the interleaved image
+
+    double minValue = 255.0, maxValue = 0.0;
+
+    for (auto &plane: planes)
+    {
+        cv::Mat filtered;
+        filter2DFreq(plane(roi), filtered, Hw);
+        filtered.convertTo(plane, CV_8U);
+
+        double planeMin, planeMax;
+        cv::minMaxLoc(plane, &planeMin, &planeMax);
+        minValue = std::min(minValue, planeMin);
+        maxValue = std::max(maxValue, planeMax);
+    }
+
+    double scale = maxValue - minValue > DBL_EPSILON ? 255.0 / (maxValue - minValue) : 0.0;
+    double shift = -minValue * scale;
+
+    for (auto &plane: planes)
+        plane.convertTo(plane, CV_8U, scale, shift);
+}
+
 // Equalize histogram
 
 std::string EqualizeHist::name = "Equalize histogram";
@@ -288,17 +416,84 @@ EqualizeHist::EqualizeHist(bool on): ImageOperation(on){}
 
 void EqualizeHist::applyOperation(cv::Mat &src)
 {
-    cv::cvtColor(src, src, cv::COLOR_BGR2YCrCb);
+    // Luma as computed by cv::cvtColor(BGR2YCrCb), in fixed point
+
+    auto luma = [](const uchar *pixel)
+    {
+        return (1868 * pixel[0] + 9617 * pixel[1] + 4899 * pixel[2] + 8192) >> 14;
+    };
+
+    // First pass: luma histogram, one partial histogram per stripe of rows
+
+    int stripes = std::max(1, std::min(src.rows, cv::getNumThreads() * 4));
+    std::vector<std::vector<int>> partialHistograms(stripes, std::vector<int>(256, 0));
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range)
+    {
+        for (int stripe = range.start; stripe < range.end; stripe++)
+        {
+            int *histogram = partialHistograms[stripe].data();
 
-    std::vector<cv::Mat> channels;
-    cv::split(src, channels);
+            for (int row = src.rows * stripe / stripes; row < src.rows * (stripe + 1) / stripes; row++)
+            {
+                const uchar *p = src.ptr<uchar>(row);
+                for (int col = 0; col < src.cols; col++, p += 3)
+                    histogram[luma(p)]++;
+            }
+        }
+    });
 
-    cv::equalizeHist(channels[0], channels[0]);
+    std::vector<int> histogram(256, 0);
+    for (auto &partialHistogram: partialHistograms)
+        for (int i = 0; i < 256; i++)
+            histogram[i] += partialHistogram[i];
+
+    // cv::equalizeHist's look-up table
+
+    uchar lut[256];
+    for (int i = 0; i < 256; i++)
+        lut[i] = static_cast<uchar>(i);
+
+    int total = static_cast<int>(src.total());
+    int i = 0;
+    while (histogram[i] == 0) i++;
+
+    if (histogram[i] == total)
+    {
+        for (int j = 0; j < 256; j++)
+            lut[j] = i;
+    }
+    else
+    {
+        float scale = 255.0f / (total - histogram[i]);
+        int sum = 0;
+        for (lut[i++] = 0; i < 256; i++)
+        {
+            sum += histogram[i];
+            lut[i] = cv::saturate_cast<uchar>(sum * scale);
+        }
+    }
 
-    cv::merge(channels, src);
+    // Second pass: equal shift of the three channels, which moves luma to its equalized value and leaves chroma as it is
 
-    cv::cvtColor(src, src, cv::COLOR_YCrCb2BGR);
+    int shift[256];
+    for (int j = 0; j < 256; j++)
+        shift[j] = lut[j] - j;
 
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &range)
+    {
+        for (int row = range.start; row < range.end; row++)
+        {
+            uchar *p = src.ptr<uchar>(row);
+            for (int col = 0; col < src.cols; col++, p += 3)
+            {
+                int d = shift[luma(p)];
+                p[0] = cv::saturate_cast<uchar>(p[0] + d);
+                p[1] = cv::saturate_cast<uchar>(p[1] + d);
+                p[2] = cv::saturate_cast<uchar>(p[2] + d);
+            }
+        }
+    });
 }
 
 // Filter 2D
@@ -307,20 +502,322 @@ std::string Filter2D::name = "Filter 2D";
 
 Filter2D::Filter2D(bool on, std::vector<float> v): ImageOperation(on)
 {
-    kernel = new KernelParameter("Kernel", v, -1000.0, 1000.0, true);
+    kernel = new KernelParameter("Kernel", v, -1000.0, 1000.0, true, true);
 
     updateKernelMat();
 }
 
 void Filter2D::updateKernelMat()
 {
-    kernelMat = cv::Mat(kernel->values).reshape(0, 3);
+    // Square kernel of odd size, as many elements as values
+
+    int size = static_cast<int>(round(sqrt(kernel->values.size())));
+
+    kernelMat = cv::Mat(kernel->values, true).reshape(0, size);
     kernelMat.convertTo(kernelMat, CV_32F);
+
+    filter.setKernel(kernelMat);
+
+    oldValues = kernel->values;
+}
+
+bool Filter2D::getLinearKernel(cv::Mat &theKernel, bool &absolute)
+{
+    if (kernel->values != oldValues)
+        updateKernelMat();
+
+    theKernel = kernelMat;
+    absolute = false;
+    return true;
 }
 
 void Filter2D::applyOperation(cv::Mat &src)
 {
-    cv::filter2D(src, src, -1, kernelMat, cv::Point(-1, -1), 0.0, cv::BORDER_ISOLATED);
+    if (kernel->values != oldValues)
+        updateKernelMat();
+
+    filter.apply(src, src);
+}
+
+// Fused linear filter
+
+std::string FusedLinearFilter::name = "Fused linear filter";
+
+bool FusedLinearFilter::withinTolerance(const std::vector<cv::Mat> &kernels, const std::vector<bool> &absolutes)
+{
+    // An intermediate image cannot saturate if its kernel is nonnegative with sum at most one
+    // Its rounding error, at most half a level, reaches the output amplified by the L1 norm of the remaining kernels
+
+    double roundingError = 0.0;
+    cv::Mat downstream;
+
+    for (int i = static_cast<int>(kernels.size()) - 1; i >= 0; i--)
+    {
+        if (!downstream.empty())
+        {
+            double minValue;
+            cv::minMaxLoc(kernels[i], &minValue);
+
+            if (absolutes[i] || minValue < 0.0 || cv::sum(kernels[i])[0] > 1.0 + 1.0e-6)
+                return false;
+
+            roundingError += 0.5 * cv::norm(downstream, cv::NORM_L1);
+        }
+
+        downstream = downstream.empty() ? kernels[i] : composeCached(kernels[i], downstream);
+    }
+
+    return roundingError <= 1.0;
+}
+
+bool FusedLinearFilter::worthFusing(const std::vector<ImageOperation*> &operations, const std::vector<cv::Mat> &kernels)
+{
+    const double passCost = 4.0;
+
+    double chainCost = 0.0;
+    bool separable = true;
+    int size = 1;
+
+    for (size_t i = 0; i < operations.size(); i++)
+    {
+        chainCost += operations[i]->getLinearCost() + passCost;
+        separable = separable && operations[i]->isSeparableKernel();
+        size += kernels[i].rows - 1;
+    }
+
+    return LinearFilter::estimateCost(size, separable) + passCost < chainCost;
+}
+
+cv::Mat FusedLinearFilter::composeCached(const cv::Mat &a, const cv::Mat &b)
+{
+    // Small cache, most recently used first; kernels are matched by value, so it follows any parameter change
+
+    struct Composition
+    {
+        cv::Mat a, b, c;
+    };
+
+    static std::vector<Composition> cache;
+
+    auto equal = [](const cv::Mat &x, const cv::Mat &y)
+    {
+        return x.size() == y.size() && x.type() == y.type() && cv::norm(x, y, cv::NORM_INF) == 0.0;
+    };
+
+    for (size_t i = 0; i < cache.size(); i++)
+    {
+        if (equal(cache[i].a, a) && equal(cache[i].b, b))
+        {
+            Composition composition = cache[i];
+            cache.erase(cache.begin() + i);
+            cache.insert(cache.begin(), composition);
+            return composition.c;
+        }
+    }
+
+    Composition composition = {a.clone(), b.clone(), composeKernels(a, b)};
+    cache.insert(cache.begin(), composition);
+
+    if (cache.size() > 32)
+        cache.pop_back();
+
+    return composition.c;
+}
+
+void FusedLinearFilter::setOperations(const std::vector<ImageOperation*> &theOperations, const std::vector<cv::Mat> &kernels, bool abs)
+{
+    operations = theOperations;
+    absolute = abs;
+
+    cv::Mat fused = kernels[0];
+    for (size_t i = 1; i < kernels.size(); i++)
+        fused = composeCached(fused, kernels[i]);
+
+    // Keep the filter's cached state (such as a kernel spectrum) unless the kernel changed
+
+    if (kernel.size() != fused.size() || cv::norm(kernel, fused, cv::NORM_INF) > 0.0)
+    {
+        kernel = fused.clone();
+        filter.setKernel(kernel);
+    }
+}
+
+void FusedLinearFilter::applyOperation(cv::Mat &src)
+{
+    int radius = kernel.rows / 2;
+
+    if (src.rows < 4 * radius || src.cols < 4 * radius)
+    {
+        for (auto operation: operations)
+            operation->applyOperation(src);
+        return;
+    }
+
+    // Border strips of width radius, computed by the original chain on strips twice as wide:
+    // the strips' inner cut only affects their inner half
+
+    cv::Mat top, bottom, left, right;
+
+    if (radius > 0)
+    {
+        top = src.rowRange(0, 2 * radius).clone();
+        bottom = src.rowRange(src.rows - 2 * radius, src.rows).clone();
+        left = src.colRange(0, 2 * radius).clone();
+        right = src.colRange(src.cols - 2 * radius, src.cols).clone();
+
+        for (auto operation: operations)
+        {
+            operation->applyOperation(top);
+            operation->applyOperation(bottom);
+            operation->applyOperation(left);
+            operation->applyOperation(right);
+        }
+    }
+
+    cv::Mat dst;
+
+    if (absolute)
+    {
+        cv::Mat signedDst;
+        cv::filter2D(src, signedDst, CV_16S, kernel, cv::Point(-1, -1), 0.0, cv::BORDER_ISOLATED);
+        cv::convertScaleAbs(signedDst, dst);
+    }
+    else
+    {
+        filter.apply(src, dst);
+    }
+
+    if (radius > 0)
+    {
+        top.rowRange(0, radius).copyTo(dst.rowRange(0, radius));
+        bottom.rowRange(radius, 2 * radius).copyTo(dst.rowRange(src.rows - radius, src.rows));
+        left.colRange(0, radius).copyTo(dst.colRange(0, radius));
+        right.colRange(radius, 2 * radius).copyTo(dst.colRange(src.cols - radius, src.cols));
+    }
+
+    src = dst;
+}
+
+// Fused color matrix
+
+std::string FusedColorMatrix::name = "Fused color matrix";
+
+cv::Mat FusedColorMatrix::composeColorMatrices(const cv::Mat &a, const cv::Mat &b)
+{
+    cv::Mat c(3, 4, CV_64F);
+
+    cv::Mat product = b.colRange(0, 3) * a.colRange(0, 3);
+    product.copyTo(c.colRange(0, 3));
+
+    cv::Mat offset = b.colRange(0, 3) * a.col(3) + b.col(3);
+    offset.copyTo(c.col(3));
+
+    return c;
+}
+
+static bool isChannelSelection(const cv::Mat &matrix)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        int ones = 0;
+
+        for (int j = 0; j < 4; j++)
+        {
+            double value = matrix.at<double>(i, j);
+
+            if (value == 1.0 && j < 3) ones++;
+            else if (value != 0.0) return false;
+        }
+
+        if (ones != 1)
+            return false;
+    }
+
+    return true;
+}
+
+bool FusedColorMatrix::withinTolerance(const std::vector<cv::Mat> &matrices)
+{
+    // An intermediate map followed by anything but channel selections must keep [0, 255] within [0, 255]
+    // Unless its coefficients are integers, its rounding error, at most half a level, reaches the output
+    // amplified by the largest row L1 norm of the remaining map
+
+    double roundingError = 0.0;
+    cv::Mat downstream;
+    bool selectionsDownstream = true;
+
+    for (int i = static_cast<int>(matrices.size()) - 1; i >= 0; i--)
+    {
+        const cv::Mat &matrix = matrices[i];
+
+        if (!selectionsDownstream && !isChannelSelection(matrix))
+        {
+            bool integer = true;
+
+            for (int r = 0; r < 3; r++)
+            {
+                double low = matrix.at<double>(r, 3), high = matrix.at<double>(r, 3);
+
+                for (int c = 0; c < 3; c++)
+                {
+                    double value = matrix.at<double>(r, c);
+
+                    if (value < 0.0) low += 255.0 * value;
+                    else high += 255.0 * value;
+                }
+
+                if (low < -1.0e-6 || high > 255.0 + 1.0e-6)
+                    return false;
+
+                for (int c = 0; c < 4; c++)
+                    if (matrix.at<double>(r, c) != std::floor(matrix.at<double>(r, c)))
+                        integer = false;
+            }
+
+            if (!integer)
+            {
+                double norm = 0.0;
+
+                for (int r = 0; r < 3; r++)
+                    norm = std::max(norm, std::abs(downstream.at<double>(r, 0)) + std::abs(downstream.at<double>(r, 1)) + std::abs(downstream.at<double>(r, 2)));
+
+                roundingError += 0.5 * norm;
+            }
+        }
+
+        downstream = downstream.empty() ? matrix : composeColorMatrices(matrix, downstream);
+        selectionsDownstream = selectionsDownstream && isChannelSelection(matrix);
+    }
+
+    return roundingError <= 1.0;
+}
+
+void FusedColorMatrix::setMatrices(const std::vector<cv::Mat> &matrices)
+{
+    matrix = matrices[0];
+    for (size_t i = 1; i < matrices.size(); i++)
+        matrix = composeColorMatrices(matrix, matrices[i]);
+}
+
+bool FusedColorMatrix::matchesChain(const std::vector<ImageOperation*> &operations)
+{
+    // Probe pixels with distinct channels, so that any mismatched channel routing shows up
+
+    cv::Mat probe = (cv::Mat_<cv::Vec3b>(1, 4) << cv::Vec3b(10, 20, 30), cv::Vec3b(255, 0, 128), cv::Vec3b(0, 255, 64), cv::Vec3b(200, 100, 50));
+
+    cv::Mat chained = probe.clone();
+    for (auto operation: operations)
+        operation->applyOperation(chained);
+
+    cv::Mat fused = probe.clone();
+    applyOperation(fused);
+
+    return cv::norm(chained, fused, cv::NORM_INF) <= 1.0;
+}
+
+void FusedColorMatrix::applyOperation(cv::Mat &src)
+{
+    cv::transform(src, src, matrix);
 }
 
 // Gamma correction
@@ -334,32 +831,89 @@ GammaCorrection::GammaCorrection(bool on, double g): ImageOperation(on)
     gamma = new DoubleParameter("Gamma", g, minGamma, maxGamma, 0.0, 1.0e6);
 }
 
-void GammaCorrection::applyOperation(cv::Mat &src)
+void GammaCorrection::computeLookUpTable(cv::Mat &lookUpTable)
 {
-    cv::Mat lookUpTable = cv::Mat(1, 256, CV_8U);
+    lookUpTable = cv::Mat(1, 256, CV_8U);
     uchar *p = lookUpTable.ptr();
     for (int i = 0; i < 256; i++)
         p[i] = cv::saturate_cast<uchar>(cv::pow(i / 255.0, gamma->value) * 255.0);
+}
+
+void GammaCorrection::applyOperation(cv::Mat &src)
+{
+    cv::Mat lookUpTable;
+    computeLookUpTable(lookUpTable);
 
     cv::LUT(src, lookUpTable, src);
 }
 
+void GammaCorrection::applyOperationPlanar(std::vector<cv::Mat> &planes)
+{
+    cv::Mat lookUpTable;
+    computeLookUpTable(lookUpTable);
+
+    for (auto &plane: planes)
+        cv::LUT(plane, lookUpTable, plane);
+}
+
 // Gaussian blur
 
 std::string GaussianBlur::name = "Blur: Gaussian";
 
-GaussianBlur::GaussianBlur(bool on, int k, double s): ImageOperation(on)
+GaussianBlur::GaussianBlur(bool on, int k, double s, int e): ImageOperation(on)
 {
     ksize = new IntParameter("Kernel size", k, 0, 51, true);
 
     double minSigma, maxSigma;
     adjustMinMax(s, 0.001, 5.0, minSigma, maxSigma);
     sigma = new DoubleParameter("Sigma", s, minSigma, maxSigma, 1.0e-6, 1.0e6);
+
+    engine = gaussianEngineParameter(e);
+}
+
+bool GaussianBlur::getLinearKernel(cv::Mat &kernel, bool &absolute)
+{
+    if (useRecursiveGaussian(engine->value, ksize->value, sigma->value))
+        return false;
+
+    // Kernel size derived from sigma as cv::GaussianBlur does for 8-bit images
+
+    int size = ksize->value > 0 ? ksize->value : (cvRound(sigma->value * 6 + 1) | 1);
+
+    cv::Mat gaussian = cv::getGaussianKernel(size, sigma->value, CV_32F);
+    kernel = gaussian * gaussian.t();
+    absolute = false;
+    return true;
+}
+
+int GaussianBlur::getHalo()
+{
+    // cv::GaussianBlur derives the kernel size of 8-bit images from sigma when it is zero
+
+    if (useRecursiveGaussian(engine->value, ksize->value, sigma->value))
+        return -1;
+    else if (ksize->value > 0)
+        return ksize->value / 2;
+    else
+        return (cvRound(sigma->value * 6 + 1) | 1) / 2;
+}
+
+double GaussianBlur::getCostFactor()
+{
+    // Separable kernel: cost proportional to its size, constant for the recursive filter
+
+    if (useRecursiveGaussian(engine->value, ksize->value, sigma->value))
+        return 1.0;
+
+    return 2 * getHalo() + 1;
 }
 
 void GaussianBlur::applyOperation(cv::Mat &src)
 {
-    cv::GaussianBlur(src, src, cv::Size(ksize->value, ksize->value), sigma->value, sigma->value, cv::BORDER_ISOLATED);
+    if (useRecursiveGaussian(engine->value, ksize->value, sigma->value))
+        recursiveGaussianBlur(src, src, sigma->value);
+    else
+        cv::GaussianBlur(src, src, cv::Size(ksize->value, ksize->value), sigma->value, sigma->value, cv::BORDER_ISOLATED);
 }
 
 // Invert colors
@@ -373,6 +927,12 @@ void InvertColors::applyOperation(cv::Mat &src)
     cv::bitwise_not(src, src);
 }
 
+void InvertColors::applyOperationPlanar(std::vector<cv::Mat> &planes)
+{
+    for (auto &plane: planes)
+        cv::bitwise_not(plane, plane);
+}
+
 // Laplacian
 
 std::string Laplacian::name = "Laplacian";
@@ -382,19 +942,50 @@ Laplacian::Laplacian(bool on, int k): ImageOperation(on)
     ksize = new IntParameter("Kernel size", k, 1, 51, true);
 }
 
+bool Laplacian::getLinearKernel(cv::Mat &kernel, bool &absolute)
+{
+    // Same kernels as cv::Laplacian
+
+    if (ksize->value == 1)
+    {
+        kernel = (cv::Mat_<float>(3, 3) << 0, 1, 0, 1, -4, 1, 0, 1, 0);
+    }
+    else if (ksize->value == 3)
+    {
+        kernel = (cv::Mat_<float>(3, 3) << 2, 0, 2, 0, -8, 0, 2, 0, 2);
+    }
+    else
+    {
+        cv::Mat derivative, smoothing;
+        cv::getDerivKernels(derivative, smoothing, 2, 0, ksize->value, false, CV_32F);
+        kernel = smoothing * derivative.t() + derivative * smoothing.t();
+    }
+
+    absolute = true;
+
+    // Not linear if the 16-bit intermediate result can saturate
+
+    return 255.0 * cv::norm(kernel, cv::NORM_L1) <= 32767.0;
+}
+
 void Laplacian::applyOperation(cv::Mat &src)
 {
-    cv::Mat channels[3];
-    cv::split(src, channels);
+    // cv::Laplacian filters each channel independently, no need to split
 
-    cv::Mat lap[3];
-    cv::Laplacian(channels[0], lap[0], CV_16S, ksize->value, 1.0, 0.0, cv::BORDER_ISOLATED);
-    cv::Laplacian(channels[1], lap[1], CV_16S, ksize->value, 1.0, 0.0, cv::BORDER_ISOLATED);
-    cv::Laplacian(channels[2], lap[2], CV_16S, ksize->value, 1.0, 0.0, cv::BORDER_ISOLATED);
+    cv::Mat lap;
+    cv::Laplacian(src, lap, CV_16S, ksize->value, 1.0, 0.0, cv::BORDER_ISOLATED);
+    cv::convertScaleAbs(lap, src);
+}
 
-    cv::merge(lap, 3, src);
+void Laplacian::applyOperationPlanar(std::vector<cv::Mat> &planes)
+{
+    cv::Mat lap;
 
-    cv::convertScaleAbs(src, src);
+    for (auto &plane: planes)
+    {
+        cv::Laplacian(plane, lap, CV_16S, ksize->value, 1.0, 0.0, cv::BORDER_ISOLATED);
+        cv::convertScaleAbs(lap, plane);
+    }
 }
 
 // Median blur
@@ -408,7 +999,7 @@ MedianBlur::MedianBlur(bool on, int size): ImageOperation(on)
 
 void MedianBlur::applyOperation(cv::Mat &src)
 {
-    cv::medianBlur(src, src, ksize->value);
+    bandedMedianBlur(src, src, ksize->value);
 }
 
 // Mix BGR channels
@@ -417,7 +1008,7 @@ std::string MixBGRChannels::name = "Mix BGR channels";
 
 MixBGRChannels::MixBGRChannels(bool on, std::vector<float> v): ImageOperation(on)
 {
-    kernel = new KernelParameter("Mix matrix", v, -10.0, 10.0, false);
+    kernel = new KernelParameter("Mix matrix", v, -10.0, 10.0, false, false);
 
     updateKernelMat();
 }
@@ -428,16 +1019,19 @@ void MixBGRChannels::updateKernelMat()
     kernelMat.convertTo(kernelMat, CV_32F);
 }
 
+bool MixBGRChannels::getColorMatrix(cv::Mat &matrix)
+{
+    matrix = cv::Mat::zeros(3, 4, CV_64F);
+    kernelMat.convertTo(matrix.colRange(0, 3), CV_64F);
+
+    return true;
+}
+
 void MixBGRChannels::applyOperation(cv::Mat &src)
 {
-    src.forEach<cv::Vec3b>([&](cv::Vec3b &pixel, const int*)
-    {
-        cv::Vec3b tmp;
-        tmp[0] = cv::saturate_cast<uchar>(kernelMat.at<float>(0, 0) * pixel[0] + kernelMat.at<float>(0, 1) * pixel[1] + kernelMat.at<float>(0, 2) * pixel[2]);
-        tmp[1] = cv::saturate_cast<uchar>(kernelMat.at<float>(1, 0) * pixel[0] + kernelMat.at<float>(1, 1) * pixel[1] + kernelMat.at<float>(1, 2) * pixel[2]);
-        tmp[2] = cv::saturate_cast<uchar>(kernelMat.at<float>(2, 0) * pixel[0] + kernelMat.at<float>(2, 1) * pixel[1] + kernelMat.at<float>(2, 2) * pixel[2]);
-        pixel = tmp;
-    });
+    // Vectorized fixed-point path of cv::transform for 8-bit three channel images
+
+    cv::transform(src, src, kernelMat);
 }
 
 // Morphological operations
@@ -458,12 +1052,116 @@ MorphologyEx::MorphologyEx(bool on, int k, int its, cv::MorphTypes type, cv::Mor
     std::vector<cv::MorphShapes> shapeValues = {cv::MORPH_RECT, cv::MORPH_CROSS, cv::MORPH_ELLIPSE};
 
     morphShape = new OptionsParameter<cv::MorphShapes>("Shape", shapeValueNames, shapeValues, shape);
+
+    updateStructuringElement();
+}
+
+void MorphologyEx::updateStructuringElement()
+{
+    oldKSize = ksize->value;
+    oldIterations = iterations->value;
+    oldMorphShape = morphShape->value;
+
+    element = cv::getStructuringElement(morphShape->value, cv::Size(ksize->value, ksize->value));
+
+    // Rectangle, cross and ellipse elements are all unions of centered rectangles
+
+    decomposeStructuringElement(element, elementRects);
+
+    // Iterating with a rectangle equals a single pass with a larger rectangle
+    // Iterating with a cross equals a single pass with the union of the rectangles spanned by its arms
+
+    foldedRects.clear();
+
+    int n = iterations->value;
+
+    if (elementRects.size() == 1)
+    {
+        foldedRects.push_back(cv::Size(n * elementRects[0].width, n * elementRects[0].height));
+    }
+    else if (elementRects.size() == 2 && elementRects[0].height == 0 && elementRects[1].width == 0)
+    {
+        for (int i = 0; i <= n; i++)
+            foldedRects.push_back(cv::Size(i * elementRects[0].width, (n - i) * elementRects[1].height));
+    }
+}
+
+void MorphologyEx::erodeDilate(const cv::Mat &src, cv::Mat &dst, bool dilate)
+{
+    if (!foldedRects.empty())
+    {
+        vanHerkMorphology(src, dst, foldedRects, dilate);
+    }
+    else
+    {
+        vanHerkMorphology(src, dst, elementRects, dilate);
+
+        for (int i = 1; i < iterations->value; i++)
+            vanHerkMorphology(dst, dst, elementRects, dilate);
+    }
+}
+
+double MorphologyEx::getCostFactor()
+{
+    // Erosion and dilation run in constant time per pixel; compound operations take two of them per iteration
+
+    bool compound = morphType->value != cv::MORPH_ERODE && morphType->value != cv::MORPH_DILATE;
+    return iterations->value * (compound ? 2.0 : 1.0);
 }
 
 void MorphologyEx::applyOperation(cv::Mat &src)
 {
-    cv::Mat element = cv::getStructuringElement(morphShape->value, cv::Size(ksize->value, ksize->value));
-    cv::morphologyEx(src, src, morphType->value, element, cv::Point(-1, -1), iterations->value, cv::BORDER_ISOLATED);
+    if (ksize->value != oldKSize || iterations->value != oldIterations || morphShape->value != oldMorphShape)
+        updateStructuringElement();
+
+    if (src.depth() != CV_8U || elementRects.empty())
+    {
+        cv::morphologyEx(src, src, morphType->value, element, cv::Point(-1, -1), iterations->value, cv::BORDER_ISOLATED);
+        return;
+    }
+
+    cv::Mat eroded, dilated;
+
+    if (morphType->value == cv::MORPH_ERODE)
+    {
+        erodeDilate(src, src, false);
+    }
+    else if (morphType->value == cv::MORPH_DILATE)
+    {
+        erodeDilate(src, src, true);
+    }
+    else if (morphType->value == cv::MORPH_OPEN)
+    {
+        erodeDilate(src, eroded, false);
+        erodeDilate(eroded, src, true);
+    }
+    else if (morphType->value == cv::MORPH_CLOSE)
+    {
+        erodeDilate(src, dilated, true);
+        erodeDilate(dilated, src, false);
+    }
+    else if (morphType->value == cv::MORPH_GRADIENT)
+    {
+        erodeDilate(src, eroded, false);
+        erodeDilate(src, dilated, true);
+        cv::subtract(dilated, eroded, src);
+    }
+    else if (morphType->value == cv::MORPH_TOPHAT)
+    {
+        erodeDilate(src, eroded, false);
+        erodeDilate(eroded, dilated, true);
+        cv::subtract(src, dilated, src);
+    }
+    else if (morphType->value == cv::MORPH_BLACKHAT)
+    {
+        erodeDilate(src, dilated, true);
+        erodeDilate(dilated, eroded, false);
+        cv::subtract(eroded, src, src);
+    }
+    else
+    {
+        cv::morphologyEx(src, src, morphType->value, element, cv::Point(-1, -1), iterations->value, cv::BORDER_ISOLATED);
+    }
 }
 
 // Pixelate
@@ -477,26 +1175,70 @@ Pixelate::Pixelate(bool on, int size): ImageOperation(on)
 
 void Pixelate::applyOperation(cv::Mat &src)
 {
-    cv::Mat dst(src.rows, src.cols, src.type());
+    int size = pixelSize->value;
+
+    if (size <= 1)
+        return;
 
-    cv::Rect square;
+    int blockCols = (src.cols + size - 1) / size;
+    int blockRows = (src.rows + size - 1) / size;
 
-    for (int row = 0; row < src.rows; row += pixelSize->value)
+    // Each block is replaced in place by its rounded mean color, as cv::mean followed by cv::rectangle would do
+    // Rows of blocks are independent: sums accumulated in one pass over their pixels, then written back
+
+    cv::parallel_for_(cv::Range(0, blockRows), [&](const cv::Range &range)
     {
-        square.y = row;
-        square.height = row + pixelSize->value < src.rows ? pixelSize->value : src.rows - row;
+        std::vector<int> sums(3 * blockCols);
+        std::vector<cv::Vec3b> colors(blockCols);
 
-        for (int col = 0; col < src.cols; col += pixelSize->value)
+        for (int blockRow = range.start; blockRow < range.end; blockRow++)
         {
-            square.x = col;
-            square.width = col + pixelSize->value < src.cols ? pixelSize->value : src.cols - col;
+            int rowStart = blockRow * size;
+            int rowEnd = std::min(rowStart + size, src.rows);
 
-            cv::Scalar meanColor = cv::mean(cv::Mat(src, square));
-            cv::rectangle(dst, square, meanColor, cv::FILLED);
-        }
-    }
+            std::fill(sums.begin(), sums.end(), 0);
 
-    src = dst.clone();
+            for (int row = rowStart; row < rowEnd; row++)
+            {
+                const uchar *p = src.ptr<uchar>(row);
+
+                for (int block = 0; block < blockCols; block++)
+                {
+                    int colEnd = std::min((block + 1) * size, src.cols);
+                    int *sum = &sums[3 * block];
+
+                    for (int col = block * size; col < colEnd; col++)
+                    {
+                        sum[0] += p[3 * col];
+                        sum[1] += p[3 * col + 1];
+                        sum[2] += p[3 * col + 2];
+                    }
+                }
+            }
+
+            for (int block = 0; block < blockCols; block++)
+            {
+                int width = std::min((block + 1) * size, src.cols) - block * size;
+                double scale = 1.0 / (width * (rowEnd - rowStart));
+
+                for (int c = 0; c < 3; c++)
+                    colors[block][c] = cv::saturate_cast<uchar>(sums[3 * block + c] * scale);
+            }
+
+            for (int row = rowStart; row < rowEnd; row++)
+            {
+                cv::Vec3b *p = src.ptr<cv::Vec3b>(row);
+
+                for (int block = 0; block < blockCols; block++)
+                {
+                    int colEnd = std::min((block + 1) * size, src.cols);
+
+                    for (int col = block * size; col < colEnd; col++)
+                        p[col] = colors[block];
+                }
+            }
+        }
+    });
 }
 
 // Radial remap
@@ -530,9 +1272,11 @@ void RadialRemap::updateMappingMatrices()
     mapX = cv::Mat(size, CV_32FC1);
     mapY = cv::Mat(size, CV_32FC1);
 
-    float rMax = 0.5 * mapX.cols;
+    // Centered on the frame, with the radius reaching the nearest edge
+
+    float rMax = 0.5 * std::min(mapX.cols, mapX.rows);
     float centerX = 0.5 * mapX.cols;
-    float centerY = 0.5 * mapX.cols;
+    float centerY = 0.5 * mapX.rows;
 
     float pi = 3.14159265359;
 
@@ -665,24 +1409,32 @@ Saturate::Saturate(bool on, double g, double b): ImageOperation(on)
 
 void Saturate::applyOperation(cv::Mat &src)
 {
-    cv::Mat hsv;
-    cv::cvtColor(src, hsv, cv::COLOR_BGR2HSV);
+    convertColorSpace(src, COLOR_SPACE_BGR, COLOR_SPACE_HSV);
+    applyOperationInColorSpace(src);
+    convertColorSpace(src, COLOR_SPACE_HSV, COLOR_SPACE_BGR);
+}
 
-    cv::Mat channels[3];
-    cv::split(hsv, channels);
+void Saturate::applyOperationInColorSpace(cv::Mat &src)
+{
+    // Saturation mapped through a look-up table built by convertTo itself, hue and value left as they are
 
-    channels[1].convertTo(channels[1], -1, gain->value, bias->value);
+    cv::Mat identity(1, 256, CV_8U), saturation;
+    for (int i = 0; i < 256; i++)
+        identity.at<uchar>(i) = i;
+    identity.convertTo(saturation, -1, gain->value, bias->value);
 
-    cv::merge(channels, 3, hsv);
+    cv::Mat lookUpTable;
+    cv::Mat tables[3] = {identity, saturation, identity};
+    cv::merge(tables, 3, lookUpTable);
 
-    cv::cvtColor(hsv, src, cv::COLOR_HSV2BGR);
+    cv::LUT(src, lookUpTable, src);
 }
 
 // Sharpen
 
 std::string Sharpen::name = "Sharpen";
 
-Sharpen::Sharpen(bool on, double s, double t, double a): ImageOperation(on)
+Sharpen::Sharpen(bool on, double s, double t, double a, int e): ImageOperation(on)
 {
     double minSigma, maxSigma;
     adjustMinMax(s, 0.001, 10.0, minSigma, maxSigma);
@@ -695,16 +1447,24 @@ Sharpen::Sharpen(bool on, double s, double t, double a): ImageOperation(on)
     double minAmount, maxAmount;
     adjustMinMax(a, 0.0, 10.0, minAmount, maxAmount);
     amount = new DoubleParameter("Amount", a, minAmount, maxAmount, -1.0e6, 1.0e6);
+
+    engine = gaussianEngineParameter(e);
+}
+
+double Sharpen::getCostFactor()
+{
+    // Blur kernel size as cv::GaussianBlur derives it from sigma, constant for the recursive filter
+
+    if (useRecursiveGaussian(engine->value, 0, sigma->value))
+        return 1.0;
+
+    return cvRound(sigma->value * 6 + 1) | 1;
 }
 
 void Sharpen::applyOperation(cv::Mat &src)
 {
-    cv::Mat blurred;
-    cv::GaussianBlur(src, blurred, cv::Size(), sigma->value, sigma->value, cv::BORDER_ISOLATED);
-    cv::Mat lowContrastMask = abs(src - blurred) < threshold->value;
-    cv::Mat sharpened = src * (1 + amount->value) + blurred * (-amount->value);
-    src.copyTo(sharpened, lowContrastMask);
-    src = sharpened.clone();
+    bool recursive = useRecursiveGaussian(engine->value, 0, sigma->value);
+    unsharpMask(src, src, sigma->value, threshold->value, amount->value, recursive);
 }
 
 // Shift hue
@@ -718,12 +1478,14 @@ ShiftHue::ShiftHue(bool on, int d): ImageOperation(on)
 
 void ShiftHue::applyOperation(cv::Mat &src)
 {
-    cv::Mat hsv;
-    cv::cvtColor(src, hsv, cv::COLOR_BGR2HSV);
-
-    hsv.forEach<cv::Vec3b>([&](cv::Vec3b &pixel, const int*){ pixel[0] = (pixel[0] + delta->value) % 180; });
+    convertColorSpace(src, COLOR_SPACE_BGR, COLOR_SPACE_HSV);
+    applyOperationInColorSpace(src);
+    convertColorSpace(src, COLOR_SPACE_HSV, COLOR_SPACE_BGR);
+}
 
-    cv::cvtColor(hsv, src, cv::COLOR_HSV2BGR);
+void ShiftHue::applyOperationInColorSpace(cv::Mat &src)
+{
+    src.forEach<cv::Vec3b>([&](cv::Vec3b &pixel, const int*){ pixel[0] = (pixel[0] + delta->value) % 180; });
 }
 
 // Swap channels
@@ -740,6 +1502,22 @@ SwapChannels::SwapChannels(bool on, int b, int g, int r): ImageOperation(on)
     red = new OptionsParameter<int>("Red", valueNames, values, r);
 }
 
+bool SwapChannels::getColorMatrix(cv::Mat &matrix)
+{
+    // In place cv::mixChannels copies channel k into channel to[k], one pair after another,
+    // so a pair reading an already overwritten channel copies its new value
+
+    int to[] = {blue->value, green->value, red->value};
+
+    matrix = cv::Mat::eye(3, 4, CV_64F);
+
+    for (int k = 0; k < 3; k++)
+        if (to[k] != k)
+            matrix.row(k).copyTo(matrix.row(to[k]));
+
+    return true;
+}
+
 void SwapChannels::applyOperation(cv::Mat &src)
 {
     int fromTo[] = {0, blue->value, 1, green->value, 2, red->value};
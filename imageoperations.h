@@ -19,11 +19,26 @@
 #define IMAGEOPERATIONS_H
 
 #include "parameter.h"
+#include "filters.h"
 #include <opencv2/imgproc.hpp>
 #include <opencv2/photo.hpp>
 #include <vector>
 #include <string>
+#include <algorithm>
 #include <cmath>
+#include <cfloat>
+
+// Frame layouts: interleaved BGR image, or one plane per channel
+// Operations declare the layout they prefer and the pipeline converts only when it changes
+
+enum FrameLayout { LAYOUT_INTERLEAVED, LAYOUT_PLANAR, LAYOUT_ANY };
+
+// Frame color spaces: operations working in another space than BGR receive the frame already converted
+// The pipeline converts only when the space changes, so adjacent operations in the same space share conversions
+
+enum FrameColorSpace { COLOR_SPACE_BGR, COLOR_SPACE_HSV, COLOR_SPACE_HLS, COLOR_SPACE_YCRCB };
+
+void convertColorSpace(cv::Mat &image, FrameColorSpace from, FrameColorSpace to);
 
 // Base image operation class
 
@@ -44,6 +59,21 @@ public:
     virtual std::vector<OptionsParameter<cv::InterpolationFlags>*> getInterpolationFlagParameters(){ std::vector<OptionsParameter<cv::InterpolationFlags>*> parameters; return parameters; };
     virtual KernelParameter* getKernelParameter(){ return nullptr; }
 
+    // Linear operations return their correlation kernel: output = saturate(round(kernel * src)), zero border
+    // If absolute, the output is saturate(|round(kernel * src)|) instead
+
+    virtual bool getLinearKernel(cv::Mat&, bool&){ return false; }
+
+    // Cost per pixel of a linear operation run on its own, in multiply-adds, and whether its kernel is separable
+    // Chains are only fused when the fused kernel is estimated to be cheaper
+
+    virtual double getLinearCost(){ return 0.0; }
+    virtual bool isSeparableKernel(){ return false; }
+
+    // Affine color operations return their 3x4 matrix (CV_64F): output = saturate(round(matrix * (b, g, r, 1)))
+
+    virtual bool getColorMatrix(cv::Mat&){ return false; }
+
     void adjustMinMax(double value, double minValue, double maxValue, double &min, double &max)
     {
         if (value < minValue) min = value;
@@ -53,8 +83,63 @@ public:
         else max = maxValue;
     }
 
+    // Gaussian engines: direct convolution, recursive filter (cost independent of sigma) or automatic choice
+
+    OptionsParameter<int>* gaussianEngineParameter(int value)
+    {
+        std::vector<std::string> names = {"Direct", "Recursive", "Auto"};
+        std::vector<int> values = {0, 1, 2};
+        return new OptionsParameter<int>("Engine", names, values, value);
+    }
+
+    bool useRecursiveGaussian(int engine, int ksize, double sigma)
+    {
+        // Below sigma = 0.5 the recursive approximation breaks down
+        // Auto only picks it when the kernel size follows from sigma and the direct kernel is wide
+
+        if (sigma < 0.5) return false;
+        else if (engine == 1) return true;
+        else if (engine == 2) return ksize == 0 && sigma >= 3.0;
+        else return false;
+    }
+
     virtual void applyOperation(cv::Mat &src) = 0;
 
+    virtual FrameLayout getLayout(){ return LAYOUT_INTERLEAVED; }
+    virtual void applyOperationPlanar(std::vector<cv::Mat> &planes)
+    {
+        cv::Mat src;
+        cv::merge(planes, src);
+        applyOperation(src);
+        cv::split(src, planes);
+    }
+
+    virtual FrameColorSpace getColorSpace(){ return COLOR_SPACE_BGR; }
+    virtual void applyOperationInColorSpace(cv::Mat &src){ applyOperation(src); }
+
+    // Called by the pipeline once per frame, before the operation runs: cached state that depends on the parameters
+    // is refreshed here, so that applying the operation only reads it, even concurrently on tiles
+
+    virtual void prepareFrame(){}
+
+    // Operations whose output rows only depend on input rows within a halo, with isolated image borders, return it
+    // and may then run concurrently on tiles of large frames (see tiledApply); -1 for global or stateful operations
+
+    virtual int getHalo(){ return -1; }
+
+    // Relative cost per pixel for the current parameters, only comparable between operations of the same type
+    // The cost model turns it into milliseconds with a coefficient per type, calibrated from pipeline timings
+
+    virtual double getCostFactor(){ return 1.0; }
+
+    double interpolationCostFactor(cv::InterpolationFlags flag)
+    {
+        if (flag == cv::INTER_NEAREST) return 1.0;
+        else if (flag == cv::INTER_LINEAR) return 2.0;
+        else if (flag == cv::INTER_LANCZOS4) return 8.0;
+        else return 4.0;
+    }
+
     ImageOperation(bool on): enabled(on){};
     virtual ~ImageOperation(){};
 };
@@ -65,22 +150,29 @@ class BilateralFilter: public ImageOperation
 {
     IntParameter *diameter;
     DoubleParameter *sigmaColor, *sigmaSpace;
+    OptionsParameter<int> *engine;
 
 public:
     static std::string name;
 
-    BilateralFilter(bool on, int d, double sc, double ss);
+    BilateralFilter(bool on, int d, double sc, double ss, int e);
     ~BilateralFilter()
     {
         delete diameter;
         delete sigmaColor;
         delete sigmaSpace;
+        delete engine;
     }
 
     std::string getName(){ return name; };
 
     std::vector<IntParameter*> getIntParameters(){ std::vector<IntParameter*> parameters = {diameter}; return parameters; };
     std::vector<DoubleParameter*> getDoubleParameters(){ std::vector<DoubleParameter*> parameters = {sigmaColor, sigmaSpace}; return parameters; };
+    std::vector<OptionsParameter<int>*> getOptionsIntParameters(){ std::vector<OptionsParameter<int>*> parameters = {engine}; return parameters; };
+
+    int getHalo();
+
+    double getCostFactor();
 
     void applyOperation(cv::Mat &src);
 };
@@ -110,6 +202,8 @@ public:
     std::vector<IntParameter*> getIntParameters(){ std::vector<IntParameter*> parameters = {size}; return parameters; };
     std::vector<DoubleParameter*> getDoubleParameters(){ std::vector<DoubleParameter*> parameters = {blendFactor}; return parameters; };
 
+    double getCostFactor(){ return std::max(size->value, 1); }
+
     void applyOperation(cv::Mat &src);
 };
 
@@ -129,6 +223,15 @@ public:
 
     std::vector<IntParameter*> getIntParameters(){ std::vector<IntParameter*> parameters = {ksize}; return parameters; };
 
+    bool getLinearKernel(cv::Mat &kernel, bool &absolute);
+
+    // cv::blur keeps running sums: its cost does not depend on the kernel size
+
+    double getLinearCost(){ return 4.0; }
+    bool isSeparableKernel(){ return true; }
+
+    int getHalo(){ return ksize->value / 2; }
+
     void applyOperation(cv::Mat &src);
 };
 
@@ -158,6 +261,8 @@ public:
     std::vector<IntParameter*> getIntParameters(){ std::vector<IntParameter*> parameters = {apertureSize}; return parameters; };
     std::vector<DoubleParameter*> getDoubleParameters(){ std::vector<DoubleParameter*> parameters = {threshold1, threshold2}; return parameters; };
 
+    double getCostFactor(){ return apertureSize->value; }
+
     void applyOperation(cv::Mat &src);
 };
 
@@ -168,6 +273,13 @@ class ColorQuantization: public ImageOperation
     IntParameter *bgrLevels, *hueLevels, *lightLevels, *satLevels;
     OptionsParameter<int> *colorSpace;
 
+    // Quantization tables, recomputed only when the color space or a level count changes
+
+    cv::Mat lookUpTable;
+    std::vector<int> tableKey;
+
+    void computeLookUpTable();
+
 public:
     static std::string name;
 
@@ -186,7 +298,13 @@ public:
     std::vector<IntParameter*> getIntParameters(){ std::vector<IntParameter*> parameters = {bgrLevels, hueLevels, lightLevels, satLevels}; return parameters; };
     std::vector<OptionsParameter<int>*> getOptionsIntParameters(){ std::vector<OptionsParameter<int>*> parameters = {colorSpace}; return parameters; };
 
+    FrameColorSpace getColorSpace(){ return colorSpace->value == 1 ? COLOR_SPACE_HLS : COLOR_SPACE_BGR; }
+
+    void prepareFrame(){ computeLookUpTable(); }
+    int getHalo(){ return 0; }
+
     void applyOperation(cv::Mat &src);
+    void applyOperationInColorSpace(cv::Mat &src);
 };
 
 // Convert to
@@ -209,7 +327,14 @@ public:
 
     std::vector<DoubleParameter*> getDoubleParameters(){ std::vector<DoubleParameter*> parameters = {alpha, beta}; return parameters; };
 
+    bool getColorMatrix(cv::Mat &matrix);
+
+    FrameLayout getLayout(){ return LAYOUT_ANY; }
+
+    int getHalo(){ return 0; }
+
     void applyOperation(cv::Mat &src);
+    void applyOperationPlanar(std::vector<cv::Mat> &planes);
 };
 
 // Deblur filter
@@ -236,7 +361,11 @@ public:
     void computeWnrFilter(const cv::Mat &input_h_PSF, cv::Mat &output_G, double nsr);
     void fftShift(const cv::Mat &inputImg, cv::Mat &outputImg);
     void filter2DFreq(const cv::Mat &inputImg, cv::Mat &outputImg, const cv::Mat &H);
+
+    FrameLayout getLayout(){ return LAYOUT_PLANAR; }
+
     void applyOperation(cv::Mat &src);
+    void applyOperationPlanar(std::vector<cv::Mat> &planes);
 };
 
 // Equalize histogram
@@ -258,6 +387,8 @@ public:
 class Filter2D: public ImageOperation
 {
     KernelParameter *kernel;
+    std::vector<float> oldValues;
+    LinearFilter filter;
 
 public:
     static std::string name;
@@ -271,16 +402,92 @@ public:
 
     KernelParameter* getKernelParameter(){ return kernel; }
 
+    bool getLinearKernel(cv::Mat &theKernel, bool &absolute);
+
+    double getLinearCost(){ return filter.getCost(); }
+    bool isSeparableKernel(){ return filter.getPath() == LinearFilter::PATH_SEPARABLE; }
+
     void updateKernelMat();
     void applyOperation(cv::Mat &src);
 };
 
+// Fused linear filter
+
+// Internal operation, not selectable by the user: applies a chain of linear operations in a single pass
+// Pixels within the fused radius of the border are computed by the original chain, since the intermediate
+// images' zero borders are not part of the fused kernel
+
+class FusedLinearFilter: public ImageOperation
+{
+    std::vector<ImageOperation*> operations;
+    cv::Mat kernel;
+    bool absolute;
+    LinearFilter filter;
+
+    // Compositions are cached between frames, as kernels rarely change and composing is O(n^4)
+
+    static cv::Mat composeCached(const cv::Mat &a, const cv::Mat &b);
+
+public:
+    static std::string name;
+
+    FusedLinearFilter(): ImageOperation(true), absolute(false){}
+
+    std::string getName(){ return name; };
+
+    // Only fuse while intermediate images cannot saturate and the accumulated rounding error stays within one level
+
+    static bool withinTolerance(const std::vector<cv::Mat> &kernels, const std::vector<bool> &absolutes);
+
+    // Only fuse while the fused kernel is estimated to be cheaper than the chain, each pass of which streams the frame
+
+    static bool worthFusing(const std::vector<ImageOperation*> &operations, const std::vector<cv::Mat> &kernels);
+
+    void setOperations(const std::vector<ImageOperation*> &theOperations, const std::vector<cv::Mat> &kernels, bool abs);
+    void applyOperation(cv::Mat &src);
+};
+
+// Fused color matrix
+
+// Internal operation, not selectable by the user: applies a chain of affine color operations as one cv::transform
+
+class FusedColorMatrix: public ImageOperation
+{
+    cv::Mat matrix;
+
+public:
+    static std::string name;
+
+    FusedColorMatrix(): ImageOperation(true){}
+
+    std::string getName(){ return name; };
+
+    // Matrix of the color map a followed by b
+    // Channel selections commute with rounding and saturation, so they always fuse
+    // Other intermediate maps must not saturate, and the accumulated rounding error must stay within one level
+
+    static cv::Mat composeColorMatrices(const cv::Mat &a, const cv::Mat &b);
+    static bool withinTolerance(const std::vector<cv::Mat> &matrices);
+
+    void setMatrices(const std::vector<cv::Mat> &matrices);
+
+    // Whether the fused matrix gives the output of the chain it replaces, within one level, on a few probe pixels
+
+    bool matchesChain(const std::vector<ImageOperation*> &operations);
+
+    int getHalo(){ return 0; }
+
+    void applyOperation(cv::Mat &src);
+};
+
 // Gamma correction
 
 class GammaCorrection: public ImageOperation
 {
     DoubleParameter *gamma;
 
+    void computeLookUpTable(cv::Mat &lookUpTable);
+
 public:
     static std::string name;
 
@@ -291,7 +498,12 @@ public:
 
     std::vector<DoubleParameter*> getDoubleParameters(){ std::vector<DoubleParameter*> parameters = {gamma}; return parameters; };
 
+    FrameLayout getLayout(){ return LAYOUT_ANY; }
+
+    int getHalo(){ return 0; }
+
     void applyOperation(cv::Mat &src);
+    void applyOperationPlanar(std::vector<cv::Mat> &planes);
 };
 
 // Gaussian blur
@@ -300,21 +512,33 @@ class GaussianBlur: public ImageOperation
 {
     IntParameter *ksize;
     DoubleParameter *sigma;
+    OptionsParameter<int> *engine;
 
 public:
     static std::string name;
 
-    GaussianBlur(bool on, int k, double s);
+    GaussianBlur(bool on, int k, double s, int e);
     ~GaussianBlur()
     {
         delete ksize;
         delete sigma;
+        delete engine;
     }
 
     std::string getName(){ return name; };
 
     std::vector<IntParameter*> getIntParameters(){ std::vector<IntParameter*> parameters = {ksize}; return parameters; };
     std::vector<DoubleParameter*> getDoubleParameters(){ std::vector<DoubleParameter*> parameters = {sigma}; return parameters; };
+    std::vector<OptionsParameter<int>*> getOptionsIntParameters(){ std::vector<OptionsParameter<int>*> parameters = {engine}; return parameters; };
+
+    bool getLinearKernel(cv::Mat &kernel, bool &absolute);
+
+    double getLinearCost(){ return 2.0 * (2 * getHalo() + 1); }
+    bool isSeparableKernel(){ return true; }
+
+    int getHalo();
+
+    double getCostFactor();
 
     void applyOperation(cv::Mat &src);
 };
@@ -329,7 +553,13 @@ public:
     InvertColors(bool on);
 
     std::string getName(){ return name; };
+
+    FrameLayout getLayout(){ return LAYOUT_ANY; }
+
+    int getHalo(){ return 0; }
+
     void applyOperation(cv::Mat &src);
+    void applyOperationPlanar(std::vector<cv::Mat> &planes);
 };
 
 // Laplacian
@@ -351,7 +581,20 @@ public:
 
     std::vector<IntParameter*> getIntParameters(){ std::vector<IntParameter*> parameters = {ksize}; return parameters; };
 
+    bool getLinearKernel(cv::Mat &kernel, bool &absolute);
+
+    // cv::Laplacian runs two pairs of separable passes above the 3x3 aperture
+
+    double getLinearCost(){ return ksize->value == 1 ? 5.0 : 4.0 * ksize->value; }
+
+    FrameLayout getLayout(){ return LAYOUT_PLANAR; }
+
+    int getHalo(){ return ksize->value == 1 ? 1 : ksize->value / 2; }
+
+    double getCostFactor(){ return ksize->value; }
+
     void applyOperation(cv::Mat &src);
+    void applyOperationPlanar(std::vector<cv::Mat> &planes);
 };
 
 // Median blur
@@ -370,6 +613,10 @@ public:
 
     std::vector<IntParameter*> getIntParameters(){ std::vector<IntParameter*> parameters = {ksize}; return parameters; };
 
+    int getHalo(){ return ksize->value / 2; }
+
+    double getCostFactor(){ return ksize->value; }
+
     void applyOperation(cv::Mat &src);
 };
 
@@ -391,7 +638,12 @@ public:
 
     KernelParameter* getKernelParameter(){ return kernel; }
 
+    bool getColorMatrix(cv::Mat &matrix);
+
     void updateKernelMat();
+
+    int getHalo(){ return 0; }
+
     void applyOperation(cv::Mat &src);
 };
 
@@ -403,6 +655,14 @@ class MorphologyEx: public ImageOperation
     OptionsParameter<cv::MorphTypes> *morphType;
     OptionsParameter<cv::MorphShapes> *morphShape;
 
+    int oldKSize, oldIterations;
+    cv::MorphShapes oldMorphShape;
+
+    cv::Mat element;
+    std::vector<cv::Size> elementRects, foldedRects;
+    void updateStructuringElement();
+    void erodeDilate(const cv::Mat &src, cv::Mat &dst, bool dilate);
+
 public:
     static std::string name;
 
@@ -410,6 +670,7 @@ public:
     ~MorphologyEx()
     {
         delete ksize;
+        delete iterations;
         delete morphType;
         delete morphShape;
     }
@@ -420,6 +681,8 @@ public:
     std::vector<OptionsParameter<cv::MorphTypes>*> getMorphTypeParameters(){ std::vector<OptionsParameter<cv::MorphTypes>*> parameters = {morphType}; return parameters; };
     std::vector<OptionsParameter<cv::MorphShapes>*> getMorphShapeParameters(){ std::vector<OptionsParameter<cv::MorphShapes>*> parameters = {morphShape}; return parameters; };
 
+    double getCostFactor();
+
     void applyOperation(cv::Mat &src);
 };
 
@@ -472,6 +735,8 @@ public:
     std::vector<OptionsParameter<int>*> getOptionsIntParameters(){ std::vector<OptionsParameter<int>*> parameters = {radialFunction}; return parameters; };
     std::vector<OptionsParameter<cv::InterpolationFlags>*> getInterpolationFlagParameters(){ std::vector<OptionsParameter<cv::InterpolationFlags>*> parameters = {flag}; return parameters; };
 
+    double getCostFactor(){ return interpolationCostFactor(flag->value); }
+
     void applyOperation(cv::Mat &src);
 };
 
@@ -498,6 +763,8 @@ public:
     std::vector<DoubleParameter*> getDoubleParameters(){ std::vector<DoubleParameter*> parameters = {angle, scale}; return parameters; };
     std::vector<OptionsParameter<cv::InterpolationFlags>*> getInterpolationFlagParameters(){ std::vector<OptionsParameter<cv::InterpolationFlags>*> parameters = {flag}; return parameters; };
 
+    double getCostFactor(){ return interpolationCostFactor(flag->value); }
+
     void applyOperation(cv::Mat &src);
 };
 
@@ -521,7 +788,12 @@ public:
 
     std::vector<DoubleParameter*> getDoubleParameters(){ std::vector<DoubleParameter*> parameters = {gain, bias}; return parameters; };
 
+    FrameColorSpace getColorSpace(){ return COLOR_SPACE_HSV; }
+
+    int getHalo(){ return 0; }
+
     void applyOperation(cv::Mat &src);
+    void applyOperationInColorSpace(cv::Mat &src);
 };
 
 // Sharpen
@@ -529,21 +801,26 @@ public:
 class Sharpen: public ImageOperation
 {
     DoubleParameter *sigma, *threshold, *amount;
+    OptionsParameter<int> *engine;
 
 public:
     static std::string name;
 
-    Sharpen(bool on, double s, double t, double a);
+    Sharpen(bool on, double s, double t, double a, int e);
     ~Sharpen()
     {
         delete sigma;
         delete threshold;
         delete amount;
+        delete engine;
     }
 
     std::string getName(){ return name; };
 
     std::vector<DoubleParameter*> getDoubleParameters(){ std::vector<DoubleParameter*> parameters = {sigma, threshold, amount}; return parameters; };
+    std::vector<OptionsParameter<int>*> getOptionsIntParameters(){ std::vector<OptionsParameter<int>*> parameters = {engine}; return parameters; };
+
+    double getCostFactor();
 
     void applyOperation(cv::Mat &src);
 };
@@ -564,7 +841,12 @@ public:
 
     std::vector<IntParameter*> getIntParameters(){ std::vector<IntParameter*> parameters = {delta}; return parameters; };
 
+    FrameColorSpace getColorSpace(){ return COLOR_SPACE_HSV; }
+
+    int getHalo(){ return 0; }
+
     void applyOperation(cv::Mat &src);
+    void applyOperationInColorSpace(cv::Mat &src);
 };
 
 // Swap channels
@@ -588,6 +870,10 @@ public:
 
     std::vector<OptionsParameter<int>*> getOptionsIntParameters(){ std::vector<OptionsParameter<int>*> parameters = {blue, green, red}; return parameters; };
 
+    bool getColorMatrix(cv::Mat &matrix);
+
+    int getHalo(){ return 0; }
+
     void applyOperation(cv::Mat &src);
 };
 
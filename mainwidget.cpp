@@ -34,8 +34,9 @@ MainWidget::MainWidget(QWidget *parent): QWidget(parent)
     pixelIterationPlot = new ImageIterationPlot("Evolution of single pixel colors", 0.0, 255.0, this);
     histogramPlot = new HistogramPlot("BGR Histogram", 0.0, 255.0, this);
     histogramPlot->setYMax(generator->getHistogramMax());
-    colorSpacePlot = new ScatterPlot("Color-space plot", 0.0, 255.0, 0.0, 255.0, this);
+    colorSpacePlot = new DensityPlot("Color-space plot", this);
     colorSpacePixelPlot = new CurvePlot("Color-space trajectory of single pixel", 0.0, 255.0, 0.0, 255.0, this);
+    patternScalePlot = new ScalarIterationPlot("Evolution of full image pattern scale", "Wavelength (pixels)", this);
 
     // Qt
 
@@ -64,8 +65,19 @@ MainWidget::MainWidget(QWidget *parent): QWidget(parent)
     plotsTabWidget->addTab(pixelIterationPlot->plot, "Single pixel color intensity");
     plotsTabWidget->addTab(colorSpacePlot->plot, "Full image color-space");
     plotsTabWidget->addTab(colorSpacePixelPlot->plot, "Single pixel color-space");
+    plotsTabWidget->addTab(patternScalePlot->plot, "Full image pattern scale");
     plotsTabWidget->hide();
 
+    // Plots are replotted at most 20 times per second, and only the visible one
+
+    plotRefreshScheduler = new PlotRefreshScheduler(plotsTabWidget, 20, this);
+    plotRefreshScheduler->addPlot(histogramPlot);
+    plotRefreshScheduler->addPlot(imageIterationPlot);
+    plotRefreshScheduler->addPlot(pixelIterationPlot);
+    plotRefreshScheduler->addPlot(colorSpacePlot);
+    plotRefreshScheduler->addPlot(colorSpacePixelPlot);
+    plotRefreshScheduler->addPlot(patternScalePlot);
+
     // Status bar
 
     statusBar = new QStatusBar;
@@ -102,6 +114,7 @@ MainWidget::~MainWidget()
 {
     delete timer;
 
+    delete plotRefreshScheduler;
     delete plotsTabWidget;
 
     delete histogramPlot;
@@ -109,6 +122,7 @@ MainWidget::~MainWidget()
     delete pixelIterationPlot;
     delete colorSpacePlot;
     delete colorSpacePixelPlot;
+    delete patternScalePlot;
 
     delete generator;
 }
@@ -160,17 +174,25 @@ void MainWidget::constructGeneralControls()
     timerIntervalLineEdit->setValidator(timeIntervalIntValidator);
     timerIntervalLineEdit->setText(QString::number(timerInterval));
 
-    imageSizeLineEdit = new CustomLineEdit;
-    imageSizeLineEdit->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
-    QIntValidator *imageSizeIntValidator = new QIntValidator(0, 4096, imageSizeLineEdit);
-    imageSizeIntValidator->setLocale(QLocale::English);
-    imageSizeLineEdit->setValidator(imageSizeIntValidator);
-    imageSizeLineEdit->setText(QString::number(generator->getImageSize()));
+    imageWidthLineEdit = new CustomLineEdit;
+    imageWidthLineEdit->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
+    QIntValidator *imageWidthIntValidator = new QIntValidator(0, 4096, imageWidthLineEdit);
+    imageWidthIntValidator->setLocale(QLocale::English);
+    imageWidthLineEdit->setValidator(imageWidthIntValidator);
+    imageWidthLineEdit->setText(QString::number(generator->getImageWidth()));
+
+    imageHeightLineEdit = new CustomLineEdit;
+    imageHeightLineEdit->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
+    QIntValidator *imageHeightIntValidator = new QIntValidator(0, 4096, imageHeightLineEdit);
+    imageHeightIntValidator->setLocale(QLocale::English);
+    imageHeightLineEdit->setValidator(imageHeightIntValidator);
+    imageHeightLineEdit->setText(QString::number(generator->getImageHeight()));
 
     QFormLayout *formLayout = new QFormLayout;
     formLayout->addRow("Batch size (its):", batchSizeLineEdit);
     formLayout->addRow("Time interval (ms):", timerIntervalLineEdit);
-    formLayout->addRow("Image size (px):", imageSizeLineEdit);
+    formLayout->addRow("Image width (px):", imageWidthLineEdit);
+    formLayout->addRow("Image height (px):", imageHeightLineEdit);
 
     QCheckBox *applyCircularMaskCheckBox = new QCheckBox("Apply circular mask");
     applyCircularMaskCheckBox->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
@@ -234,7 +256,7 @@ void MainWidget::constructGeneralControls()
 
     CustomLineEdit *pointerRadiusLineEdit = new CustomLineEdit;
     pointerRadiusLineEdit->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
-    QIntValidator *pointerRadiusValidator = new QIntValidator(1, generator->getImageSize() / 2, pointerRadiusLineEdit);
+    QIntValidator *pointerRadiusValidator = new QIntValidator(1, std::min(generator->getImageWidth(), generator->getImageHeight()) / 2, pointerRadiusLineEdit);
     pointerRadiusValidator->setLocale(QLocale::English);
     pointerRadiusLineEdit->setValidator(pointerRadiusValidator);
     pointerRadiusLineEdit->setText(QString::number(generator->getPointerRadius()));
@@ -312,8 +334,10 @@ void MainWidget::constructGeneralControls()
     connect(batchSizeLineEdit, &CustomLineEdit::focusOut, [=](){ batchSizeLineEdit->setText(QString::number(batchSize)); });
     connect(timerIntervalLineEdit, &CustomLineEdit::returnPressed, this, &MainWidget::setTimerInterval);
     connect(timerIntervalLineEdit, &CustomLineEdit::focusOut, [=](){ timerIntervalLineEdit->setText(QString::number(timerInterval)); });
-    connect(imageSizeLineEdit, &CustomLineEdit::returnPressed, this, &MainWidget::setImageSize);
-    connect(imageSizeLineEdit, &CustomLineEdit::focusOut, [=](){ imageSizeLineEdit->setText(QString::number(generator->getImageSize())); });
+    connect(imageWidthLineEdit, &CustomLineEdit::returnPressed, this, &MainWidget::setImageSize);
+    connect(imageWidthLineEdit, &CustomLineEdit::focusOut, [=](){ imageWidthLineEdit->setText(QString::number(generator->getImageWidth())); });
+    connect(imageHeightLineEdit, &CustomLineEdit::returnPressed, this, &MainWidget::setImageSize);
+    connect(imageHeightLineEdit, &CustomLineEdit::focusOut, [=](){ imageHeightLineEdit->setText(QString::number(generator->getImageHeight())); });
     connect(applyCircularMaskCheckBox, &QCheckBox::clicked, [=](bool checked){ generator->toggleMask(checked); });
     connect(videoFilenamePushButton, &QPushButton::clicked, this, &MainWidget::openVideoWriter);
     connect(videoCapturePushButton, &QPushButton::clicked, this, &MainWidget::onVideoCapturePushButtonClicked);
@@ -447,8 +471,12 @@ void MainWidget::constructImageManipulationControls()
     newImageOperationComboBox = new QComboBox;
     newImageOperationComboBox->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
 
+    newImageOperationCostLabel = new QLabel;
+    newImageOperationCostLabel->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
+
     QFormLayout *newImageOperationFormLayout = new QFormLayout;
     newImageOperationFormLayout->addRow("New operation:", newImageOperationComboBox);
+    newImageOperationFormLayout->addRow("Estimated time:", newImageOperationCostLabel);
 
     insertImageOperationPushButton = new QPushButton("Insert");
     insertImageOperationPushButton->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
@@ -574,12 +602,14 @@ void MainWidget::constructImageManipulationControls()
     });
     connect(imageOperationsListWidget, &QListWidget::currentRowChanged, this, &MainWidget::onImageOperationsListWidgetCurrentRowChanged);
     connect(imageOperationsListWidget->model(), &QAbstractItemModel::rowsMoved, this, &MainWidget::onRowsMoved);
+    connect(newImageOperationComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged), [=](int){ setNewImageOperationCostLabel(); });
     connect(insertImageOperationPushButton, &QPushButton::clicked, this, &MainWidget::insertImageOperation);
     connect(removeImageOperationPushButton, &QPushButton::clicked, this, &MainWidget::removeImageOperation);
 
     // Init
 
     initNewImageOperationComboBox();
+    setNewImageOperationCostLabel();
 }
 
 void MainWidget::constructComputationControls()
@@ -597,6 +627,10 @@ void MainWidget::constructComputationControls()
     dftPushButton->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
     dftPushButton->setCheckable(true);
 
+    patternScalePushButton = new QPushButton("Start plotting");
+    patternScalePushButton->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
+    patternScalePushButton->setCheckable(true);
+
     imageIterationPushButton = new QPushButton("Start plotting");
     imageIterationPushButton->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
     imageIterationPushButton->setCheckable(true);
@@ -620,6 +654,7 @@ void MainWidget::constructComputationControls()
     QFormLayout *fullImageLayout = new QFormLayout;
     fullImageLayout->addRow("Histogram:", histogramPushButton);
     fullImageLayout->addRow("DFT:", dftPushButton);
+    fullImageLayout->addRow("Pattern scale plot:", patternScalePushButton);
     fullImageLayout->addRow("Color intensity plot:", imageIterationPushButton);
     fullImageLayout->addRow("Color-space plot:", colorSpacePushButton);
     fullImageLayout->addRow("X-Axis:", colorSpaceXAxisComboBox);
@@ -683,6 +718,7 @@ void MainWidget::constructComputationControls()
 
     connect(togglePlotsPushButton, &QPushButton::clicked, [=](){ if (!plotsTabWidget->isVisible()) plotsTabWidget->show(); });
     connect(imageIterationPushButton, &QPushButton::clicked, [=](bool checked){ if (checked) imageIterationPlot->clearGraphsData(); });
+    connect(patternScalePushButton, &QPushButton::clicked, [=](bool checked){ if (checked) patternScalePlot->clearGraphData(); });
     connect(pixelIterationPushButton, &QPushButton::clicked, [=](bool checked){ if (checked) pixelIterationPlot->clearGraphsData(); });
     connect(colorSpacePixelPushButton, &QPushButton::clicked, [=](bool checked){ if (checked) colorSpacePixelPlot->clearCurveData(); });
     connect(selectPixelPushButton, &QPushButton::clicked, [=](bool checked){ generator->selectingPixel = checked; });
@@ -803,6 +839,7 @@ void MainWidget::loadConfig()
         imageIterationPlot->clearGraphsData();
         pixelIterationPlot->clearGraphsData();
         colorSpacePixelPlot->clearCurveData();
+        patternScalePlot->clearGraphData();
     }
 }
 
@@ -814,8 +851,9 @@ void MainWidget::setTimerInterval()
 
 void MainWidget::setImageSize()
 {
-    generator->setImageSize(imageSizeLineEdit->text().toInt());
+    generator->setImageSize(imageWidthLineEdit->text().toInt(), imageHeightLineEdit->text().toInt());
     histogramPlot->setYMax(generator->getHistogramMax());
+    setNewImageOperationCostLabel();
 }
 
 void MainWidget::openVideoWriter()
@@ -836,14 +874,16 @@ void MainWidget::onVideoCapturePushButtonClicked(bool checked)
 {
     if (checked)
     {
-        imageSizeLineEdit->setEnabled(false);
+        imageWidthLineEdit->setEnabled(false);
+        imageHeightLineEdit->setEnabled(false);
         videoFilenamePushButton->setEnabled(false);
         videoCapturePushButton->setText("Stop");
     }
     else
     {
         generator->closeVideoWriter();
-        imageSizeLineEdit->setEnabled(true);
+        imageWidthLineEdit->setEnabled(true);
+        imageHeightLineEdit->setEnabled(true);
         videoFilenamePushButton->setEnabled(true);
         videoCapturePushButton->setText("Start");
         videoCapturePushButton->setEnabled(false);
@@ -974,6 +1014,14 @@ void MainWidget::initNewImageOperationComboBox()
     }
 }
 
+void MainWidget::setNewImageOperationCostLabel()
+{
+    // Estimated at the current image size, refined as the cost model is calibrated
+
+    double milliseconds = generator->estimateOperationCost(newImageOperationComboBox->currentIndex());
+    newImageOperationCostLabel->setText(QString("%1 ms").arg(milliseconds, 0, 'f', 1));
+}
+
 void MainWidget::initImageOperationsListWidget(int pipelineIndex)
 {
     imageOperationsListWidget->clear();
@@ -1196,45 +1244,72 @@ void MainWidget::iterationLoop()
         generator->iterate();
         auto end = std::chrono::steady_clock::now();
 
-        // Full image computations/plots
+        // Full image and single pixel analyses run on a background worker, which drops frames while busy
+        // Snapshot plots only ask for new data when it is going to be drawn; time series take every result
 
-        if (colorSpacePushButton->isChecked())
-        {
-            int xAxisIndex = colorSpaceXAxisComboBox->currentIndex();
-            int yAxisIndex = colorSpaceYAxisComboBox->currentIndex();
+        bool colorSpaceDue = colorSpacePushButton->isChecked() && plotRefreshScheduler->isDue(colorSpacePlot);
+        bool histogramDue = histogramPushButton->isChecked() && plotRefreshScheduler->isDue(histogramPlot);
 
-            colorSpacePlot->setData(generator->getColorComponents(xAxisIndex), generator->getColorComponents(yAxisIndex));
-        }
+        bool statistics = colorSpaceDue || histogramDue || imageIterationPushButton->isChecked();
+        bool pixel = pixelIterationPushButton->isChecked() || colorSpacePixelPushButton->isChecked();
+        bool patternScale = patternScalePushButton->isChecked();
+
+        // The spectrum view is refreshed at most 5 times per second
 
-        if (dftPushButton->isChecked())
-            generator->computeDFT();
+        bool spectrum = false;
 
-        if (histogramPushButton->isChecked())
+        if (dftPushButton->isChecked() && std::chrono::duration_cast<std::chrono::milliseconds>(start - spectrumViewTimePoint).count() >= 200)
         {
-            generator->computeHistogram();
-            histogramPlot->setData(generator->getHistogramBins(), generator->getBlueHistogram(), generator->getGreenHistogram(), generator->getRedHistogram());
+            spectrum = true;
+            spectrumViewTimePoint = start;
         }
 
-        if (imageIterationPushButton->isChecked())
+        if (statistics || pixel || spectrum || patternScale)
         {
-            generator->computeBGRSum();
-            imageIterationPlot->addPoint(generator->getIterationNumber(), generator->getBSum(), generator->getGSum(), generator->getRSum());
+            if (colorSpaceDue)
+                generator->requestAnalysis(statistics, colorSpaceXAxisComboBox->currentIndex(), colorSpaceYAxisComboBox->currentIndex(), spectrum, patternScale, pixel);
+            else
+                generator->requestAnalysis(statistics, -1, -1, spectrum, patternScale, pixel);
         }
 
-        // Single pixel computations/plots
+        if (generator->collectAnalysis())
+        {
+            const AnalysisWorker::Result &analysis = generator->getAnalysis();
 
-        if (pixelIterationPushButton->isChecked() || colorSpacePixelPushButton->isChecked())
-            generator->computeBGRPixel();
+            if (analysis.statistics)
+            {
+                const FrameStatistics &frameStatistics = analysis.frameStatistics;
 
-        if (pixelIterationPushButton->isChecked())
-            pixelIterationPlot->addPoint(generator->getIterationNumber(), generator->getPixelComponent(0), generator->getPixelComponent(1), generator->getPixelComponent(2));
+                if (colorSpacePushButton->isChecked() && !frameStatistics.density.empty() &&
+                    frameStatistics.densityX == colorSpaceXAxisComboBox->currentIndex() && frameStatistics.densityY == colorSpaceYAxisComboBox->currentIndex())
+                    colorSpacePlot->setData(generator->getColorDensity());
 
-        if (colorSpacePixelPushButton->isChecked())
-        {
-            int xAxisIndex = colorSpacePixelXAxisComboBox->currentIndex();
-            int yAxisIndex = colorSpacePixelYAxisComboBox->currentIndex();
+                if (histogramPushButton->isChecked())
+                    histogramPlot->setData(generator->getHistogramBins(), generator->getBlueHistogram(), generator->getGreenHistogram(), generator->getRedHistogram());
+
+                if (imageIterationPushButton->isChecked())
+                    imageIterationPlot->addPoint(analysis.iteration, generator->getBSum(), generator->getGSum(), generator->getRSum());
+            }
+
+            if (analysis.spectrum && dftPushButton->isChecked())
+                generator->showSpectrum();
+
+            if (analysis.patternScale && patternScalePushButton->isChecked())
+                patternScalePlot->addPoint(analysis.iteration, analysis.patternScaleValue);
+
+            if (analysis.pixel)
+            {
+                if (pixelIterationPushButton->isChecked())
+                    pixelIterationPlot->addPoint(analysis.iteration, generator->getPixelComponent(0), generator->getPixelComponent(1), generator->getPixelComponent(2));
 
-            colorSpacePixelPlot->addPoint(generator->getPixelComponent(xAxisIndex), generator->getPixelComponent(yAxisIndex));
+                if (colorSpacePixelPushButton->isChecked())
+                {
+                    int xAxisIndex = colorSpacePixelXAxisComboBox->currentIndex();
+                    int yAxisIndex = colorSpacePixelYAxisComboBox->currentIndex();
+
+                    colorSpacePixelPlot->addPoint(generator->getPixelComponent(xAxisIndex), generator->getPixelComponent(yAxisIndex));
+                }
+            }
         }
 
         // Show out image
@@ -1272,6 +1347,14 @@ void MainWidget::iterationLoop()
 
         statusBar->clearMessage();
         statusBar->showMessage(QString("%1 Iterations | %2 ms / iteration | %3 ms / pipelines").arg(generator->getIterationNumber()).arg(iterationTime).arg(pipelineTime));
+
+        // The estimate follows the cost model's calibration, twice a second at most
+
+        if (std::chrono::duration_cast<std::chrono::milliseconds>(now - costLabelTimePoint).count() >= 500)
+        {
+            setNewImageOperationCostLabel();
+            costLabelTimePoint = now;
+        }
     }
 }
 
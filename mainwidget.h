@@ -70,12 +70,15 @@ class MainWidget : public QWidget
     ImageIterationPlot *imageIterationPlot;
     ImageIterationPlot *pixelIterationPlot;
     HistogramPlot *histogramPlot;
-    ScatterPlot *colorSpacePlot;
+    DensityPlot *colorSpacePlot;
     CurvePlot *colorSpacePixelPlot;
+    ScalarIterationPlot *patternScalePlot;
 
     QStatusBar *statusBar;
 
     std::chrono::steady_clock::time_point timePoint;
+    std::chrono::steady_clock::time_point spectrumViewTimePoint;
+    std::chrono::steady_clock::time_point costLabelTimePoint;
 
     QTabWidget *mainTabWidget;
 
@@ -94,7 +97,8 @@ class MainWidget : public QWidget
     QTimer *timer;
     int timerInterval;
 
-    CustomLineEdit *imageSizeLineEdit;
+    CustomLineEdit *imageWidthLineEdit;
+    CustomLineEdit *imageHeightLineEdit;
 
     QPushButton *videoFilenamePushButton;
     QPushButton *videoCapturePushButton;
@@ -102,6 +106,7 @@ class MainWidget : public QWidget
     QLabel *videoCaptureElapsedTimeLabel;
 
     QComboBox *newImageOperationComboBox;
+    QLabel *newImageOperationCostLabel;
     QPushButton *insertImageOperationPushButton;
     QPushButton *removeImageOperationPushButton;
 
@@ -129,6 +134,7 @@ class MainWidget : public QWidget
 
     QPushButton *togglePlotsPushButton;
     QPushButton *dftPushButton;
+    QPushButton *patternScalePushButton;
     QPushButton *imageIterationPushButton;
     QPushButton *pixelIterationPushButton;
     QPushButton *selectPixelPushButton;
@@ -142,6 +148,7 @@ class MainWidget : public QWidget
     QComboBox *colorSpacePixelYAxisComboBox;
 
     QTabWidget *plotsTabWidget;
+    PlotRefreshScheduler *plotRefreshScheduler;
 
     QWidget *generalControlsWidget;
     QWidget *imageManipulationWidget;
@@ -173,6 +180,7 @@ class MainWidget : public QWidget
     void setPipelineBlendFactorLineEditText(int pipelineIndex);
 
     void initNewImageOperationComboBox();
+    void setNewImageOperationCostLabel();
     void initImageOperationsListWidget(int imageIndex);
 
     void onImageOperationsListWidgetCurrentRowChanged(int currentRow);
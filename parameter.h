@@ -82,12 +82,14 @@ public:
     std::vector<float> values;
     float min, max;
     bool normalize;
-    KernelParameter(std::string theName, std::vector<float> theValues, float theMin, float theMax, bool norm):
+    bool resizable;
+    KernelParameter(std::string theName, std::vector<float> theValues, float theMin, float theMax, bool norm, bool res):
         name(theName),
         values(theValues),
         min(theMin),
         max(theMax),
-        normalize(norm)
+        normalize(norm),
+        resizable(res)
     {}
 };
 
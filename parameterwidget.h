@@ -245,38 +245,34 @@ class KernelParameterWidget: public QWidget
 public:
     QGridLayout *gridLayout;
     QPushButton *normalizePushButton;
+    CustomLineEdit *sizeLineEdit = nullptr;
 
     KernelParameterWidget(KernelParameter *theKernelParameter, QWidget *parent = nullptr): QWidget(parent), kernelParameter(theKernelParameter)
     {
         gridLayout = new QGridLayout;
 
-        int row = 0;
-        int col = 0;
+        buildGrid();
 
-        for (auto element: kernelParameter->values)
+        if (kernelParameter->resizable)
         {
-            CustomLineEdit *lineEdit = new CustomLineEdit;
-            lineEdit->setFixedWidth(75);
-
-            QDoubleValidator *validator = new QDoubleValidator(kernelParameter->min, kernelParameter->max, 10, lineEdit);
-            lineEdit->setValidator(validator);
-            lineEdit->setText(QString::number(element));
+            sizeLineEdit = new CustomLineEdit;
+            sizeLineEdit->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Preferred);
 
-            gridLayout->addWidget(lineEdit, row, col, Qt::AlignCenter);
+            QIntValidator *validator = new QIntValidator(1, 15, sizeLineEdit);
+            sizeLineEdit->setValidator(validator);
+            sizeLineEdit->setText(QString::number(getSize()));
 
-            col++;
-            if (col == 3)
+            connect(sizeLineEdit, &CustomLineEdit::returnPressed, [=]()
             {
-                row++;
-                col = 0;
-            }
-
-            lineEdits.push_back(lineEdit);
-        }
-        for (size_t i = 0; i < kernelParameter->values.size(); i++)
-        {
-            connect(lineEdits[i], &CustomLineEdit::returnPressed, [=](){ kernelParameter->values[i] = lineEdits[i]->text().toFloat(); });
-            connect(lineEdits[i], &CustomLineEdit::focusOut, [=](){ lineEdits[i]->setText(QString::number(kernelParameter->values[i])); });
+                int size = sizeLineEdit->text().toInt();
+                if (size % 2 == 0)
+                {
+                    size--;
+                    sizeLineEdit->setText(QString::number(size));
+                }
+                resizeKernel(size);
+            });
+            connect(sizeLineEdit, &CustomLineEdit::focusOut, [=](){ sizeLineEdit->setText(QString::number(getSize())); });
         }
 
         normalizePushButton = new QPushButton("Normalize");
@@ -290,7 +286,7 @@ public:
                 sum += fabs(element);
             if (sum > 0)
             {
-                for (size_t i = 0; i < kernelParameter->values.size(); i++)
+                for (size_t i = 0; i < kernelParameter->values.size() && i < lineEdits.size(); i++)
                 {
                     kernelParameter->values[i] /= sum;
                     lineEdits[i]->setText(QString::number(kernelParameter->values[i]));
@@ -302,6 +298,56 @@ public:
 private:
     KernelParameter *kernelParameter;
     std::vector<CustomLineEdit*> lineEdits;
+
+    int getSize(){ return static_cast<int>(round(sqrt(kernelParameter->values.size()))); }
+
+    void buildGrid()
+    {
+        for (auto lineEdit: lineEdits)
+            delete lineEdit;
+        lineEdits.clear();
+
+        int size = getSize();
+
+        for (size_t i = 0; i < kernelParameter->values.size(); i++)
+        {
+            CustomLineEdit *lineEdit = new CustomLineEdit;
+            lineEdit->setFixedWidth(75);
+
+            QDoubleValidator *validator = new QDoubleValidator(kernelParameter->min, kernelParameter->max, 10, lineEdit);
+            lineEdit->setValidator(validator);
+            lineEdit->setText(QString::number(kernelParameter->values[i]));
+
+            gridLayout->addWidget(lineEdit, i / size, i % size, Qt::AlignCenter);
+
+            lineEdits.push_back(lineEdit);
+        }
+        for (size_t i = 0; i < lineEdits.size(); i++)
+        {
+            connect(lineEdits[i], &CustomLineEdit::returnPressed, [=](){ if (i < kernelParameter->values.size()) kernelParameter->values[i] = lineEdits[i]->text().toFloat(); });
+            connect(lineEdits[i], &CustomLineEdit::focusOut, [=](){ if (i < kernelParameter->values.size()) lineEdits[i]->setText(QString::number(kernelParameter->values[i])); });
+        }
+    }
+
+    // Crops or pads with zeros around the center
+
+    void resizeKernel(int newSize)
+    {
+        int size = getSize();
+        if (newSize == size) return;
+
+        int offset = (newSize - size) / 2;
+
+        std::vector<float> values(newSize * newSize, 0.0);
+        for (int i = 0; i < newSize; i++)
+            for (int j = 0; j < newSize; j++)
+                if (i - offset >= 0 && i - offset < size && j - offset >= 0 && j - offset < size)
+                    values[i * newSize + j] = kernelParameter->values[(i - offset) * size + j - offset];
+
+        kernelParameter->values = values;
+
+        buildGrid();
+    }
 };
 
 // Operations widget
@@ -364,6 +410,8 @@ public:
         if (operation->getKernelParameter())
         {
             KernelParameterWidget *widget = new KernelParameterWidget(operation->getKernelParameter(), this);
+            if (widget->sizeLineEdit)
+                formLayout->addRow("Kernel size:", widget->sizeLineEdit);
             vBoxLayout->addWidget(new QLabel(QString::fromStdString(operation->getKernelParameter()->name) + ":"));
             vBoxLayout->addLayout(widget->gridLayout);
             vBoxLayout->addWidget(widget->normalizePushButton);
@@ -16,12 +16,137 @@
 // along with MorphogenCV.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "plots.h"
+#include <cmath>
+
+// Decimated series
+
+DecimatedSeries::DecimatedSeries(Decimation theDecimation, int theCapacity): decimation(theDecimation), capacity(theCapacity)
+{
+    clear();
+}
+
+void DecimatedSeries::clear()
+{
+    recent.clear();
+    buckets.clear();
+    bucketSize = 2;
+    current.size = 0;
+}
+
+void DecimatedSeries::addToBucket(Bucket &bucket, const Point &point)
+{
+    if (bucket.size == 0)
+    {
+        bucket.first = bucket.minimum = bucket.maximum = point;
+    }
+    else
+    {
+        if (point.value < bucket.minimum.value) bucket.minimum = point;
+        if (point.value > bucket.maximum.value) bucket.maximum = point;
+    }
+
+    bucket.size++;
+}
+
+void DecimatedSeries::mergeBuckets(Bucket &bucket, const Bucket &next)
+{
+    if (next.minimum.value < bucket.minimum.value) bucket.minimum = next.minimum;
+    if (next.maximum.value > bucket.maximum.value) bucket.maximum = next.maximum;
+    bucket.size += next.size;
+}
+
+void DecimatedSeries::addPoint(double key, double value)
+{
+    recent.push_back({key, value});
+
+    if (static_cast<int>(recent.size()) <= capacity)
+        return;
+
+    // Oldest full resolution point moves to the current bucket
+
+    addToBucket(current, recent.front());
+    recent.pop_front();
+
+    if (current.size < bucketSize)
+        return;
+
+    buckets.push_back(current);
+    current.size = 0;
+
+    // Too many buckets: halve the resolution of the old data
+
+    if (static_cast<int>(buckets.size()) > capacity)
+    {
+        std::deque<Bucket> merged;
+
+        for (size_t i = 0; i + 1 < buckets.size(); i += 2)
+        {
+            Bucket bucket = buckets[i];
+            mergeBuckets(bucket, buckets[i + 1]);
+            merged.push_back(bucket);
+        }
+
+        if (buckets.size() % 2 == 1)
+            merged.push_back(buckets.back());
+
+        buckets.swap(merged);
+        bucketSize *= 2;
+    }
+}
+
+void DecimatedSeries::appendBucket(const Bucket &bucket, QVector<double> &keys, QVector<double> &values)
+{
+    if (decimation == DECIMATION_STRIDE)
+    {
+        keys.push_back(bucket.first.key);
+        values.push_back(bucket.first.value);
+    }
+    else
+    {
+        const Point &a = bucket.minimum.key <= bucket.maximum.key ? bucket.minimum : bucket.maximum;
+        const Point &b = bucket.minimum.key <= bucket.maximum.key ? bucket.maximum : bucket.minimum;
+
+        keys.push_back(a.key);
+        values.push_back(a.value);
+
+        if (b.key != a.key)
+        {
+            keys.push_back(b.key);
+            values.push_back(b.value);
+        }
+    }
+}
+
+void DecimatedSeries::getData(QVector<double> &keys, QVector<double> &values)
+{
+    keys.clear();
+    values.clear();
+
+    int size = 2 * static_cast<int>(buckets.size()) + 2 + static_cast<int>(recent.size());
+    keys.reserve(size);
+    values.reserve(size);
+
+    for (auto &bucket: buckets)
+        appendBucket(bucket, keys, values);
+
+    if (current.size > 0)
+        appendBucket(current, keys, values);
+
+    for (auto &point: recent)
+    {
+        keys.push_back(point.key);
+        values.push_back(point.value);
+    }
+}
 
 // Image iteration plot
 
-ImageIterationPlot::ImageIterationPlot(QString title, double yMin, double yMax, QWidget *parent = nullptr): QWidget(parent)
+ImageIterationPlot::ImageIterationPlot(QString title, double yMin, double yMax, QWidget *parent = nullptr):
+    PlotWidget(parent),
+    series{{DecimatedSeries::DECIMATION_ENVELOPE, 2048}, {DecimatedSeries::DECIMATION_ENVELOPE, 2048}, {DecimatedSeries::DECIMATION_ENVELOPE, 2048}}
 {
     itMin = 1000;
+    lastIteration = 0.0;
 
     plot = new QCustomPlot(this);
 
@@ -52,13 +177,39 @@ ImageIterationPlot::ImageIterationPlot(QString title, double yMin, double yMax,
 
 void ImageIterationPlot::addPoint(double it, double blue, double green, double red)
 {
-    plot->graph(0)->addData(it, blue);
-    plot->graph(1)->addData(it, green);
-    plot->graph(2)->addData(it, red);
+    series[0].addPoint(it, blue);
+    series[1].addPoint(it, green);
+    series[2].addPoint(it, red);
+
+    lastIteration = it;
+    dirty = true;
+}
+
+void ImageIterationPlot::clearGraphsData()
+{
+    for (auto &channelSeries: series)
+        channelSeries.clear();
+
+    plot->graph(0)->data()->clear();
+    plot->graph(1)->data()->clear();
+    plot->graph(2)->data()->clear();
+
+    dirty = true;
+}
+
+void ImageIterationPlot::refresh()
+{
+    QVector<double> keys, values;
 
-    if (it > itMin)
+    for (int i = 0; i < 3; i++)
     {
-        plot->xAxis->setRange(it - itMin, it);
+        series[i].getData(keys, values);
+        plot->graph(i)->setData(keys, values, true);
+    }
+
+    if (lastIteration > itMin)
+    {
+        plot->xAxis->setRange(lastIteration - itMin, lastIteration);
     }
     else
     {
@@ -66,18 +217,77 @@ void ImageIterationPlot::addPoint(double it, double blue, double green, double r
     }
 
     plot->replot();
+    dirty = false;
 }
 
-void ImageIterationPlot::clearGraphsData()
+// Scalar iteration plot
+
+ScalarIterationPlot::ScalarIterationPlot(QString title, QString yLabel, QWidget *parent = nullptr):
+    PlotWidget(parent),
+    series(DecimatedSeries::DECIMATION_ENVELOPE, 2048)
 {
+    itMin = 1000;
+    lastIteration = 0.0;
+
+    plot = new QCustomPlot(this);
+
+    plot->xAxis->setLabel("Iteration");
+    plot->yAxis->setLabel(yLabel);
+
+    plot->setInteractions(QCP::iRangeZoom | QCP::iRangeDrag);
+
+    plot->axisRect()->setupFullAxesBox(true);
+    plot->axisRect()->setRangeZoom(Qt::Vertical | Qt::Horizontal);
+    plot->axisRect()->setRangeDrag(Qt::Vertical | Qt::Horizontal);
+
+    plot->plotLayout()->insertRow(0);
+    QCPTextElement *text = new QCPTextElement(plot, title);
+    plot->plotLayout()->addElement(0, 0, text);
+
+    plot->addGraph();
+    plot->graph(0)->setPen(QPen(Qt::black));
+}
+
+void ScalarIterationPlot::addPoint(double it, double value)
+{
+    series.addPoint(it, value);
+
+    lastIteration = it;
+    dirty = true;
+}
+
+void ScalarIterationPlot::clearGraphData()
+{
+    series.clear();
     plot->graph(0)->data()->clear();
-    plot->graph(1)->data()->clear();
-    plot->graph(2)->data()->clear();
+
+    dirty = true;
+}
+
+void ScalarIterationPlot::refresh()
+{
+    QVector<double> keys, values;
+    series.getData(keys, values);
+    plot->graph(0)->setData(keys, values, true);
+
+    if (lastIteration > itMin)
+    {
+        plot->xAxis->setRange(lastIteration - itMin, lastIteration);
+    }
+    else
+    {
+        plot->xAxis->rescale();
+    }
+
+    plot->yAxis->rescale();
+
+    plot->replot();
+    dirty = false;
 }
 
 // Histogram plot
 
-HistogramPlot::HistogramPlot(QString title, double xMin, double xMax, QWidget *parent = nullptr): QWidget(parent)
+HistogramPlot::HistogramPlot(QString title, double xMin, double xMax, QWidget *parent = nullptr): PlotWidget(parent)
 {
     plot = new QCustomPlot(this);
 
@@ -109,6 +319,7 @@ HistogramPlot::HistogramPlot(QString title, double xMin, double xMax, QWidget *p
 void HistogramPlot::setYMax(double yMax)
 {
     plot->yAxis->setRange(0.0, yMax);
+    dirty = true;
 }
 
 void HistogramPlot::setData(const QVector<double> &bins, const QVector<double> &blue, const QVector<double> &green, const QVector<double> &red)
@@ -117,20 +328,20 @@ void HistogramPlot::setData(const QVector<double> &bins, const QVector<double> &
     plot->graph(1)->setData(bins, green, true);
     plot->graph(2)->setData(bins, red, true);
 
-    plot->replot();
+    dirty = true;
 }
 
-// Scatter plot
+// Density plot
 
-ScatterPlot::ScatterPlot(QString title, double xMin, double xMax, double yMin, double yMax, QWidget *parent = nullptr): QWidget(parent)
+DensityPlot::DensityPlot(QString title, QWidget *parent = nullptr): PlotWidget(parent)
 {
     plot = new QCustomPlot(this);
 
     plot->xAxis->setLabel("Blue");
     plot->yAxis->setLabel("Green");
 
-    plot->xAxis->setRange(xMin, xMax);
-    plot->yAxis->setRange(yMin, yMax);
+    plot->xAxis->setRange(0.0, 255.0);
+    plot->yAxis->setRange(0.0, 255.0);
 
     plot->setInteractions(QCP::iRangeZoom | QCP::iRangeDrag);
 
@@ -142,28 +353,59 @@ ScatterPlot::ScatterPlot(QString title, double xMin, double xMax, double yMin, d
     QCPTextElement *text = new QCPTextElement(plot, title);
     plot->plotLayout()->addElement(0, 0, text);
 
-    plot->addGraph();
-    plot->graph(0)->setLineStyle(QCPGraph::lsNone);
-    plot->graph(0)->setScatterStyle(QCPScatterStyle(QCPScatterStyle::ssDisc, 1.0));
-    plot->graph(0)->setPen(QPen(Qt::black));
-    plot->graph(0)->setAdaptiveSampling(false);
+    // One cell per pair of values, its shade growing with the logarithm of the number of pixels
+
+    colorMap = new QCPColorMap(plot->xAxis, plot->yAxis);
+    colorMap->data()->setSize(256, 256);
+    colorMap->data()->setRange(QCPRange(0.0, 255.0), QCPRange(0.0, 255.0));
+    colorMap->setInterpolate(false);
+
+    // Empty cells white, any pixel count at least light gray
+
+    QCPColorGradient gradient;
+    gradient.clearColorStops();
+    gradient.setColorStopAt(0.0, Qt::white);
+    gradient.setColorStopAt(1.0e-6, QColor(192, 192, 192));
+    gradient.setColorStopAt(1.0, Qt::black);
+    colorMap->setGradient(gradient);
 }
 
-void ScatterPlot::setAxesLabels(QString xLabel, QString yLabel)
+void DensityPlot::setAxesLabels(QString xLabel, QString yLabel)
 {
     plot->xAxis->setLabel(xLabel);
     plot->yAxis->setLabel(yLabel);
+    dirty = true;
 }
 
-void ScatterPlot::setData(const QVector<double> &x, const QVector<double> &y)
+void DensityPlot::setData(const QVector<double> &density)
 {
-    plot->graph(0)->setData(x, y, true);
-    plot->replot();
+    // Pixel counts of a 256x256 grid, rows indexing y values
+
+    if (density.size() != 256 * 256)
+        return;
+
+    double maxValue = 0.0;
+
+    for (int y = 0; y < 256; y++)
+    {
+        for (int x = 0; x < 256; x++)
+        {
+            double value = log1p(density[256 * y + x]);
+            colorMap->data()->setCell(x, y, value);
+            if (value > maxValue) maxValue = value;
+        }
+    }
+
+    colorMap->setDataRange(QCPRange(0.0, maxValue > 0.0 ? maxValue : 1.0));
+
+    dirty = true;
 }
 
 // Curve plot
 
-CurvePlot::CurvePlot(QString title, double xMin, double xMax, double yMin, double yMax, QWidget *parent = nullptr): QWidget(parent)
+CurvePlot::CurvePlot(QString title, double xMin, double xMax, double yMin, double yMax, QWidget *parent = nullptr):
+    PlotWidget(parent),
+    series(DecimatedSeries::DECIMATION_STRIDE, 4096)
 {
     plot = new QCustomPlot(this);
 
@@ -190,15 +432,65 @@ void CurvePlot::setAxesLabels(QString xLabel, QString yLabel)
 {
     plot->xAxis->setLabel(xLabel);
     plot->yAxis->setLabel(yLabel);
+    dirty = true;
 }
 
 void CurvePlot::addPoint(double x, double y)
 {
-    curve->addData(x, y);
-    plot->replot();
+    series.addPoint(x, y);
+    dirty = true;
 }
 
 void CurvePlot::clearCurveData()
 {
+    series.clear();
     curve->data()->clear();
+    dirty = true;
+}
+
+void CurvePlot::refresh()
+{
+    QVector<double> keys, values;
+    series.getData(keys, values);
+
+    QVector<double> t(keys.size());
+    for (int i = 0; i < t.size(); i++)
+        t[i] = i;
+
+    curve->setData(t, keys, values, true);
+
+    plot->replot();
+    dirty = false;
+}
+
+// Plot refresh scheduler
+
+PlotRefreshScheduler::PlotRefreshScheduler(QTabWidget *theTabWidget, int rate, QObject *parent = nullptr):
+    QObject(parent),
+    tabWidget(theTabWidget)
+{
+    timer = new QTimer(this);
+    connect(timer, &QTimer::timeout, this, &PlotRefreshScheduler::refreshVisible);
+    connect(tabWidget, &QTabWidget::currentChanged, this, [this](int){ refreshVisible(); });
+    timer->start(1000 / rate);
+}
+
+void PlotRefreshScheduler::addPlot(PlotWidget *plotWidget)
+{
+    plots.push_back(plotWidget);
+}
+
+void PlotRefreshScheduler::refreshVisible()
+{
+    if (!tabWidget->isVisible())
+        return;
+
+    for (auto plotWidget: plots)
+        if (plotWidget->dirty && plotWidget->plot == tabWidget->currentWidget())
+            plotWidget->refresh();
+}
+
+bool PlotRefreshScheduler::isDue(PlotWidget *plotWidget)
+{
+    return !plotWidget->dirty && tabWidget->isVisible() && plotWidget->plot == tabWidget->currentWidget();
 }
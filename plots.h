@@ -22,52 +22,146 @@
 #include <QWidget>
 #include <QVector>
 #include <QString>
+#include <QTabWidget>
+#include <QTimer>
+#include <deque>
+#include <vector>
 
-class ImageIterationPlot: public QWidget
+// Bounded storage for a growing series of points
+// The most recent points are kept as they are; older ones are grouped in buckets which, once too many,
+// are merged pairwise, so memory and the number of points to plot stay bounded however long the run
+
+class DecimatedSeries
+{
+public:
+    // Envelope: each bucket keeps its points of minimum and maximum value (time series)
+    // Stride: each bucket keeps its first point (curves, where values are not ordered by key)
+
+    enum Decimation { DECIMATION_ENVELOPE, DECIMATION_STRIDE };
+
+    DecimatedSeries(Decimation theDecimation, int theCapacity);
+
+    void addPoint(double key, double value);
+    void clear();
+
+    // Points in insertion order
+
+    void getData(QVector<double> &keys, QVector<double> &values);
+
+private:
+    struct Point { double key, value; };
+    struct Bucket { Point first, minimum, maximum; int size; };
+
+    Decimation decimation;
+    int capacity;
+    int bucketSize;
+
+    std::deque<Point> recent;
+    std::deque<Bucket> buckets;
+    Bucket current;
+
+    void addToBucket(Bucket &bucket, const Point &point);
+    void mergeBuckets(Bucket &bucket, const Bucket &next);
+    void appendBucket(const Bucket &bucket, QVector<double> &keys, QVector<double> &values);
+};
+
+// Base plot: setting data only marks it dirty, and refresh() draws it
+
+class PlotWidget: public QWidget
 {
 public:
-    int itMin;
     QCustomPlot *plot;
+    bool dirty;
+
+    PlotWidget(QWidget *parent): QWidget(parent), plot(nullptr), dirty(true){}
+
+    virtual void refresh(){ plot->replot(); dirty = false; }
+};
+
+class ImageIterationPlot: public PlotWidget
+{
+    DecimatedSeries series[3];
+    double lastIteration;
+
+public:
+    int itMin;
 
     ImageIterationPlot(QString title, double yMin, double yMax, QWidget *parent);
 
     void addPoint(double it, double blue, double green, double red);
     void clearGraphsData();
+    void refresh();
 };
 
-class HistogramPlot: public QWidget
+class ScalarIterationPlot: public PlotWidget
 {
+    DecimatedSeries series;
+    double lastIteration;
+
 public:
-    QCustomPlot *plot;
+    int itMin;
+
+    ScalarIterationPlot(QString title, QString yLabel, QWidget *parent);
 
+    void addPoint(double it, double value);
+    void clearGraphData();
+    void refresh();
+};
+
+class HistogramPlot: public PlotWidget
+{
+public:
     HistogramPlot(QString title, double xMin, double xMax, QWidget *parent);
 
     void setYMax(double yMax);
     void setData(const QVector<double> &bins, const QVector<double> &blue, const QVector<double> &green, const QVector<double> &red);
 };
 
-class ScatterPlot: public QWidget
+class DensityPlot: public PlotWidget
 {
 public:
-    QCustomPlot *plot;
+    QCPColorMap *colorMap;
 
-    ScatterPlot(QString title, double xMin, double xMax, double yMin, double yMax, QWidget *parent);
+    DensityPlot(QString title, QWidget *parent);
 
     void setAxesLabels(QString xLabel, QString yLabel);
-    void setData(const QVector<double> &x, const QVector<double> &y);
+    void setData(const QVector<double> &density);
 };
 
-class CurvePlot: public QWidget
+class CurvePlot: public PlotWidget
 {
+    DecimatedSeries series;
+
 public:
     QCPCurve *curve;
-    QCustomPlot *plot;
 
     CurvePlot(QString title, double xMin, double xMax, double yMin, double yMax, QWidget *parent);
 
     void setAxesLabels(QString xLabel, QString yLabel);
     void addPoint(double x, double y);
     void clearCurveData();
+    void refresh();
+};
+
+// Replots the visible plot tab, if dirty, at most rate times per second and whenever it becomes visible
+// Hidden tabs are not replotted until shown
+
+class PlotRefreshScheduler: public QObject
+{
+    QTabWidget *tabWidget;
+    QTimer *timer;
+    std::vector<PlotWidget*> plots;
+
+    void refreshVisible();
+
+public:
+    PlotRefreshScheduler(QTabWidget *theTabWidget, int rate, QObject *parent);
+
+    void addPlot(PlotWidget *plotWidget);
+
+    // Whether new data would be shown soon: the plot is visible and its last data has already been drawn
+
+    bool isDue(PlotWidget *plotWidget);
 };
 
 #endif // IMAGEITERATIONPLOT_H
@@ -0,0 +1,298 @@
+// Copyright 2020 José María Castelo Ares
+
+// This file is part of MorphogenCV.
+
+// MorphogenCV is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// MorphogenCV is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with MorphogenCV.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "statistics.h"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+void FrameStatistics::compute(const cv::Mat &image, const cv::Mat &mask, int xChannel, int yChannel)
+{
+    CV_Assert(image.type() == CV_8UC3 && (mask.empty() || (mask.type() == CV_8U && mask.size() == image.size())));
+
+    densityX = xChannel;
+    densityY = yChannel;
+
+    bool computeDensity = densityX >= 0 && densityX < 3 && densityY >= 0 && densityY < 3;
+
+    // One partial snapshot per stripe of rows, merged afterwards
+
+    struct Partial
+    {
+        int64 sum[3];
+        int histogram[3][256];
+        uchar minimum[3], maximum[3];
+        std::vector<int> density;
+    };
+
+    int stripes = std::max(1, std::min(image.rows, cv::getNumThreads()));
+    std::vector<Partial> partials(stripes);
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range)
+    {
+        for (int stripe = range.start; stripe < range.end; stripe++)
+        {
+            Partial &partial = partials[stripe];
+
+            std::fill(partial.sum, partial.sum + 3, 0);
+            std::fill(&partial.histogram[0][0], &partial.histogram[0][0] + 3 * 256, 0);
+            std::fill(partial.minimum, partial.minimum + 3, 255);
+            std::fill(partial.maximum, partial.maximum + 3, 0);
+
+            if (computeDensity)
+                partial.density.assign(256 * 256, 0);
+
+            int *density = computeDensity ? partial.density.data() : nullptr;
+
+            for (int row = image.rows * stripe / stripes; row < image.rows * (stripe + 1) / stripes; row++)
+            {
+                const uchar *p = image.ptr<uchar>(row);
+                const uchar *m = mask.empty() ? nullptr : mask.ptr<uchar>(row);
+
+                for (int col = 0; col < image.cols; col++, p += 3)
+                {
+                    partial.sum[0] += p[0];
+                    partial.sum[1] += p[1];
+                    partial.sum[2] += p[2];
+
+                    if (density)
+                        density[(p[densityY] << 8) + p[densityX]]++;
+
+                    if (m && !m[col])
+                        continue;
+
+                    for (int c = 0; c < 3; c++)
+                    {
+                        partial.histogram[c][p[c]]++;
+                        partial.minimum[c] = std::min(partial.minimum[c], p[c]);
+                        partial.maximum[c] = std::max(partial.maximum[c], p[c]);
+                    }
+                }
+            }
+        }
+    });
+
+    bgrSum = cv::Scalar::all(0);
+    histograms = cv::Mat::zeros(3, 256, CV_32S);
+    minimum = cv::Vec3b::all(255);
+    maximum = cv::Vec3b::all(0);
+
+    if (computeDensity) density = cv::Mat::zeros(256, 256, CV_32S);
+    else density.release();
+
+    for (auto &partial: partials)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            bgrSum[c] += static_cast<double>(partial.sum[c]);
+
+            int *histogram = histograms.ptr<int>(c);
+            for (int i = 0; i < 256; i++)
+                histogram[i] += partial.histogram[c][i];
+
+            minimum[c] = std::min(minimum[c], partial.minimum[c]);
+            maximum[c] = std::max(maximum[c], partial.maximum[c]);
+        }
+
+        if (computeDensity)
+        {
+            int *d = density.ptr<int>();
+            for (int i = 0; i < 256 * 256; i++)
+                d[i] += partial.density[i];
+        }
+    }
+}
+
+// Spectrum analyzer
+
+void SpectrumAnalyzer::compute(const cv::Mat &image, bool view)
+{
+    cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+
+    // Padding is zeroed only when the size changes, then the frame is written over the same region
+
+    int m = cv::getOptimalDFTSize(image.rows);
+    int n = cv::getOptimalDFTSize(image.cols);
+
+    if (padded.rows != m || padded.cols != n)
+        padded = cv::Mat::zeros(m, n, CV_32F);
+
+    cv::Mat region = padded(cv::Rect(0, 0, image.cols, image.rows));
+    gray.convertTo(region, CV_32F);
+
+    // Real input transform
+
+    cv::dft(padded, transform, cv::DFT_COMPLEX_OUTPUT);
+
+    // Radial power spectrum
+
+    int side = std::min(m, n);
+    int maxRadius = side / 2;
+
+    ringPower.assign(maxRadius + 1, 0.0);
+
+    for (int y = 0; y < m; y++)
+    {
+        const cv::Vec2f *f = transform.ptr<cv::Vec2f>(y);
+        double fy = (y <= m / 2 ? y : y - m) * static_cast<double>(side) / m;
+
+        for (int x = 0; x < n; x++)
+        {
+            double fx = (x <= n / 2 ? x : x - n) * static_cast<double>(side) / n;
+            int r = cvRound(std::sqrt(fx * fx + fy * fy));
+
+            if (r <= maxRadius)
+                ringPower[r] += static_cast<double>(f[x][0]) * f[x][0] + static_cast<double>(f[x][1]) * f[x][1];
+        }
+    }
+
+    double weightedRadius = 0.0, totalPower = 0.0;
+
+    // Without the mean (r = 0)
+
+    for (int r = 1; r <= maxRadius; r++)
+    {
+        weightedRadius += r * ringPower[r];
+        totalPower += ringPower[r];
+    }
+
+    patternScale = weightedRadius > 0.0 ? side * totalPower / weightedRadius : 0.0;
+
+    if (!view)
+        return;
+
+    // Log magnitude written directly to its place in the centered view (even size, quadrants swapped)
+
+    int rows = m & -2, cols = n & -2;
+    int cy = rows / 2, cx = cols / 2;
+
+    logMagnitude.create(rows, cols, CV_32F);
+
+    for (int y = 0; y < rows; y++)
+    {
+        const cv::Vec2f *f = transform.ptr<cv::Vec2f>(y);
+        float *out = logMagnitude.ptr<float>((y + cy) % rows);
+
+        for (int x = 0; x < cols; x++)
+            out[(x + cx) % cols] = std::log(1.0f + std::sqrt(f[x][0] * f[x][0] + f[x][1] * f[x][1]));
+    }
+
+    cv::normalize(logMagnitude, spectrum, 0, 1, cv::NORM_MINMAX);
+}
+
+// Analysis worker
+
+AnalysisWorker::AnalysisWorker(): stopping(false), requestPending(false), resultReady(false)
+{
+    thread = std::thread(&AnalysisWorker::run, this);
+}
+
+AnalysisWorker::~AnalysisWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    condition.notify_one();
+    thread.join();
+}
+
+void AnalysisWorker::submit(const Request &request)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // A request replacing one not yet started keeps its spectrum and pattern scale: those are asked for
+        // only now and then, and would otherwise be lost whenever iterations outpace the worker
+
+        bool spectrum = requestPending && pendingRequest.spectrum;
+        bool patternScale = requestPending && pendingRequest.patternScale;
+
+        pendingRequest = request;
+        pendingRequest.spectrum = pendingRequest.spectrum || spectrum;
+        pendingRequest.patternScale = pendingRequest.patternScale || patternScale;
+        requestPending = true;
+    }
+
+    condition.notify_one();
+}
+
+bool AnalysisWorker::takeResult(Result &result)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!resultReady)
+        return false;
+
+    result = latestResult;
+    resultReady = false;
+
+    return true;
+}
+
+void AnalysisWorker::run()
+{
+    while (true)
+    {
+        Request request;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this](){ return stopping || requestPending; });
+
+            if (stopping)
+                return;
+
+            request = pendingRequest;
+            pendingRequest = Request();
+            requestPending = false;
+        }
+
+        Result result;
+        result.iteration = request.iteration;
+        result.statistics = request.statistics;
+        result.spectrum = request.spectrum;
+        result.patternScale = request.patternScale;
+        result.pixel = request.pixel && cv::Rect(0, 0, request.image.cols, request.image.rows).contains(request.pixelPosition);
+
+        if (result.statistics)
+            result.frameStatistics.compute(request.image, request.mask, request.densityX, request.densityY);
+
+        if (result.spectrum || result.patternScale)
+        {
+            spectrumAnalyzer.compute(request.image, result.spectrum);
+
+            // The analyzer's buffers are reused by the next frame
+
+            if (result.spectrum)
+                result.spectrumImage = spectrumAnalyzer.spectrum.clone();
+
+            result.patternScaleValue = spectrumAnalyzer.patternScale;
+        }
+
+        if (result.pixel)
+            result.pixelValue = request.image.at<cv::Vec3b>(request.pixelPosition);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            latestResult = result;
+            resultReady = true;
+        }
+    }
+}
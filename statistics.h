@@ -0,0 +1,148 @@
+// Copyright 2020 José María Castelo Ares
+
+// This file is part of MorphogenCV.
+
+// MorphogenCV is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// MorphogenCV is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with MorphogenCV.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <opencv2/core.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+// Snapshot of the statistics of an 8-bit BGR frame, all computed in a single parallel pass
+
+class FrameStatistics
+{
+public:
+    // Per channel sums over the whole frame, as cv::sum
+
+    cv::Scalar bgrSum;
+
+    // Per channel histograms (3 rows of 256 bins, CV_32S) and extreme values, over the pixels within the mask
+
+    cv::Mat histograms;
+    cv::Vec3b minimum, maximum;
+
+    // Number of pixels of the frame with each pair of values of two channels: rows index the y channel, columns the x one
+    // Empty unless requested
+
+    int densityX, densityY;
+    cv::Mat density;
+
+    FrameStatistics(): densityX(-1), densityY(-1){}
+
+    void compute(const cv::Mat &image, const cv::Mat &mask, int xChannel, int yChannel);
+};
+
+// Spectrum analyzer
+
+// Discrete Fourier transform of an 8-bit BGR frame's gray levels (zero padded to an optimal size), with buffers kept between frames
+// Computes the pattern scale from the power spectrum and, if asked for, the view of the spectrum
+
+class SpectrumAnalyzer
+{
+public:
+    // Power weighted mean wavelength in pixels (zero for a flat frame): the characteristic scale of the pattern
+    // Radii are integer rings in units of the fundamental frequency of the shorter padded side
+
+    double patternScale;
+
+    // Log magnitude, centered and normalized to [0, 1]
+
+    cv::Mat spectrum;
+
+    SpectrumAnalyzer(): patternScale(0.0){}
+
+    void compute(const cv::Mat &image, bool view);
+
+private:
+    cv::Mat gray, padded, transform, logMagnitude;
+    std::vector<double> ringPower;
+};
+
+// Analysis worker
+
+// Computes frame statistics, spectra and pixel probes on its own thread, off the iteration's critical path
+// Frames are shared, not copied: the caller must not modify a frame after submitting it
+// A request waiting while the worker is busy is replaced by the next one, so stale frames are dropped
+
+class AnalysisWorker
+{
+public:
+    struct Request
+    {
+        cv::Mat image, mask;
+        int iteration;
+
+        bool statistics;
+        int densityX, densityY;
+
+        bool spectrum, patternScale;
+
+        bool pixel;
+        cv::Point pixelPosition;
+
+        Request(): iteration(0), statistics(false), densityX(-1), densityY(-1), spectrum(false), patternScale(false), pixel(false){}
+    };
+
+    struct Result
+    {
+        int iteration;
+
+        bool statistics;
+        FrameStatistics frameStatistics;
+
+        bool spectrum;
+        cv::Mat spectrumImage;
+
+        bool patternScale;
+        double patternScaleValue;
+
+        bool pixel;
+        cv::Vec3b pixelValue;
+
+        Result(): iteration(0), statistics(false), spectrum(false), patternScale(false), patternScaleValue(0.0), pixel(false){}
+    };
+
+    AnalysisWorker();
+    ~AnalysisWorker();
+
+    void submit(const Request &request);
+
+    // Latest finished result, if there is a new one since the last call
+
+    bool takeResult(Result &result);
+
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    bool stopping;
+    bool requestPending;
+    bool resultReady;
+
+    Request pendingRequest;
+    Result latestResult;
+
+    SpectrumAnalyzer spectrumAnalyzer;
+
+    void run();
+};
+
+#endif // STATISTICS_H